@@ -0,0 +1,493 @@
+// Benchmark suite of the oclBenchmark target: HeavyCalculation and DotProduct over grids of problem size,
+// loop depth, local work size and host thread count, with warmup runs, repetitions and outlier rejection.
+// Results go to the console and to CSV/JSON files. The device runs use the first OpenCL device of any
+// type, so a CPU-only OpenCL implementation works; without one (or with --host-only) only the host
+// paths are measured.
+//
+// Flags: --host-only --quick --warmup=N --runs=N --elements=N --loop=N --local=N --threads=N
+//        --csv=file (benchmark.csv) --json=file (benchmark.json)
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <oclUtils.h>
+
+#include "dotProductReduction.h"
+#include "heavyCalculationSimd.h"
+#include "programCache.h"
+#include "threadPool.h"
+
+#include "heavyCalculator.cl"
+#include "dotProduct.cl"
+
+namespace
+{
+  // Compulsory traffic and arithmetic per result. HeavyCalculation reads a[k] and b[k] once per element
+  // and writes c[i]; every term costs two multiplies for the arguments, one for the product and one add,
+  // sin and cos are not counted. DotProduct reads two float4 and writes a float, dot() is 4 mul + 3 add.
+  const double HEAVY_BYTES_PER_ELEMENT = 3 * sizeof(float);
+  const double HEAVY_FLOPS_PER_TERM = 4;
+  const double DOT_BYTES_PER_ELEMENT = 2 * sizeof(cl_float4) + sizeof(float);
+  const double DOT_FLOPS_PER_ELEMENT = 7;
+  // Samples further than this many scaled median absolute deviations above the median are dropped
+  const double OUTLIER_MADS = 3.0;
+
+  struct Settings
+  {
+    bool hostOnly = false;
+    int warmup = 2;
+    int runs = 10;
+    std::vector<size_t> elements;
+    std::vector<size_t> loopDepths;
+    std::vector<size_t> localWorkSizes;
+    std::vector<size_t> threads;
+    std::string csvFile = "benchmark.csv";
+    std::string jsonFile = "benchmark.json";
+  };
+
+  struct Statistics
+  {
+    double medianMs = 0;
+    double minMs = 0;
+    double meanMs = 0;
+    double stddevMs = 0;
+    int rejected = 0;
+    bool failed = false;   // a run reported an error, the configuration has no valid time
+  };
+
+  struct Result
+  {
+    std::string workload;
+    std::string target;     // "host <ISA>" or the device name
+    size_t numElements = 0;
+    size_t maxLoopIdx = 0;
+    size_t localWorkSize = 0;  // 0: host run, or chosen by the driver
+    size_t threads = 0;        // 0: device run
+    Statistics time;
+    double elementsPerSecond = 0;
+    double gigabytesPerSecond = 0;
+    double gigaflopsPerSecond = 0;
+  };
+
+  std::vector<size_t> powersOfTwo(size_t first, size_t last)
+  {
+    std::vector<size_t> values;
+    for (size_t value = first; value <= last; value *= 2)
+      values.push_back(value);
+    return values;
+  }
+
+  Settings parseSettings(int argc, const char** argv)
+  {
+    Settings settings;
+    const bool quick = shrCheckCmdLineFlag(argc, argv, "quick") == shrTRUE;
+    settings.hostOnly = shrCheckCmdLineFlag(argc, argv, "host-only") == shrTRUE;
+    shrGetCmdLineArgumenti(argc, argv, "warmup", &settings.warmup);
+    shrGetCmdLineArgumenti(argc, argv, "runs", &settings.runs);
+    settings.warmup = std::max(settings.warmup, 0);
+    settings.runs = std::max(settings.runs, 1);
+
+    const size_t hardwareThreads = std::max<size_t>(std::thread::hardware_concurrency(), 1);
+    settings.elements = quick ? std::vector<size_t>{ 1 << 16 } : powersOfTwo(1 << 14, 1 << 20);
+    settings.loopDepths = quick ? std::vector<size_t>{ 16 } : std::vector<size_t>{ 16, 64, 256 };
+    settings.localWorkSizes = quick ? std::vector<size_t>{ 0, 256 } : std::vector<size_t>{ 0, 64, 128, 256 };
+    settings.threads = powersOfTwo(1, hardwareThreads);
+    if (settings.threads.back() != hardwareThreads)
+      settings.threads.push_back(hardwareThreads);
+    if (quick)
+      settings.threads = hardwareThreads > 1 ? std::vector<size_t>{ 1, hardwareThreads } : std::vector<size_t>{ 1 };
+
+    // A single value pins that axis of the grid
+    int value = 0;
+    if (shrGetCmdLineArgumenti(argc, argv, "elements", &value) && value > 0)
+      settings.elements = { (size_t)value };
+    if (shrGetCmdLineArgumenti(argc, argv, "loop", &value) && value >= 0)
+      settings.loopDepths = { (size_t)value };
+    if (shrGetCmdLineArgumenti(argc, argv, "local", &value) && value >= 0)
+      settings.localWorkSizes = { (size_t)value };
+    if (shrGetCmdLineArgumenti(argc, argv, "threads", &value) && value > 0)
+      settings.threads = { (size_t)value };
+
+    char* file = nullptr;
+    if (shrGetCmdLineArgumentstr(argc, argv, "csv", &file) && file)
+      settings.csvFile = file;
+    if (shrGetCmdLineArgumentstr(argc, argv, "json", &file) && file)
+      settings.jsonFile = file;
+    return settings;
+  }
+
+  double median(std::vector<double> values)
+  {
+    std::sort(values.begin(), values.end());
+    const size_t n = values.size();
+    return n % 2 ? values[n / 2] : 0.5 * (values[n / 2 - 1] + values[n / 2]);
+  }
+
+  // warmup untimed calls, then runs timed ones; slow outliers (preemption, frequency ramps) are dropped.
+  // body returns false on an error, which stops the measurement and marks the statistics as failed.
+  Statistics measure(const Settings& settings, const std::function<bool()>& body)
+  {
+    Statistics statistics;
+    for (int i = 0; i < settings.warmup; ++i)
+    {
+      if (!body())
+      {
+        statistics.failed = true;
+        return statistics;
+      }
+    }
+    std::vector<double> samples;
+    for (int i = 0; i < settings.runs; ++i)
+    {
+      const auto begin = std::chrono::steady_clock::now();
+      const bool ok = body();
+      samples.push_back(std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count());
+      if (!ok)
+      {
+        statistics.failed = true;
+        return statistics;
+      }
+    }
+
+    const double center = median(samples);
+    std::vector<double> deviations;
+    for (double sample : samples)
+      deviations.push_back(fabs(sample - center));
+    // 1.4826 scales the MAD to the standard deviation of normally distributed samples
+    const double limit = center + OUTLIER_MADS * 1.4826 * median(deviations);
+    std::vector<double> kept;
+    for (double sample : samples)
+    {
+      if (sample <= limit)
+        kept.push_back(sample);
+    }
+
+    statistics.rejected = (int)(samples.size() - kept.size());
+    statistics.medianMs = median(kept);
+    statistics.minMs = *std::min_element(kept.begin(), kept.end());
+    double sum = 0, sumOfSquares = 0;
+    for (double sample : kept)
+    {
+      sum += sample;
+      sumOfSquares += sample * sample;
+    }
+    statistics.meanMs = sum / kept.size();
+    statistics.stddevMs = sqrt(std::max(0.0, sumOfSquares / kept.size() - statistics.meanMs * statistics.meanMs));
+    return statistics;
+  }
+
+  Result makeResult(const std::string& workload, const std::string& target, size_t numElements, size_t maxLoopIdx,
+    size_t localWorkSize, size_t threads, const Statistics& time)
+  {
+    Result result;
+    result.workload = workload;
+    result.target = target;
+    result.numElements = numElements;
+    result.maxLoopIdx = maxLoopIdx;
+    result.localWorkSize = localWorkSize;
+    result.threads = threads;
+    result.time = time;
+
+    const double seconds = std::max(time.medianMs, 1.e-6) * 1.e-3;
+    const bool heavy = workload == "HeavyCalculation";
+    const double bytes = (heavy ? HEAVY_BYTES_PER_ELEMENT : DOT_BYTES_PER_ELEMENT) * numElements;
+    const double flops = (heavy ? HEAVY_FLOPS_PER_TERM * maxLoopIdx : DOT_FLOPS_PER_ELEMENT) * numElements;
+    result.elementsPerSecond = numElements / seconds;
+    result.gigabytesPerSecond = 1.e-9 * bytes / seconds;
+    result.gigaflopsPerSecond = 1.e-9 * flops / seconds;
+
+    std::cout << std::left << std::setw(18) << workload << std::setw(24) << target.substr(0, 23) << std::right
+      << std::setw(10) << numElements << std::setw(6) << maxLoopIdx << std::setw(6) << localWorkSize
+      << std::setw(5) << threads << std::fixed << std::setprecision(3) << std::setw(11) << time.medianMs
+      << std::setw(4) << time.rejected << std::setprecision(2) << std::setw(10) << 1.e-6 * result.elementsPerSecond
+      << std::setw(9) << result.gigabytesPerSecond << std::setw(9) << result.gigaflopsPerSecond << std::endl;
+    std::cout.unsetf(std::ios::fixed);
+    return result;
+  }
+
+  void printHeader()
+  {
+    std::cout << std::left << std::setw(18) << "workload" << std::setw(24) << "target" << std::right
+      << std::setw(10) << "elements" << std::setw(6) << "loop" << std::setw(6) << "local" << std::setw(5) << "thr"
+      << std::setw(11) << "median ms" << std::setw(4) << "out" << std::setw(10) << "Melem/s"
+      << std::setw(9) << "GB/s" << std::setw(9) << "GFLOP/s" << std::endl;
+  }
+
+  void fillArray(std::vector<float>& data, unsigned int seed)
+  {
+    std::minstd_rand generator(seed);
+    const float scale = 1.0f / (float)generator.max();
+    for (auto& value : data)
+      value = scale * generator();
+  }
+
+  // threads includes the calling thread, which helps the pool in parallelFor
+  void runOnThreads(size_t threads, size_t numElements, const std::function<void(size_t, size_t)>& body)
+  {
+    if (threads <= 1)
+    {
+      body(0, numElements);
+      return;
+    }
+    static std::unique_ptr<ThreadPool> pool;
+    if (!pool || pool->size() != threads - 1)
+      pool = std::make_unique<ThreadPool>(threads - 1);
+    pool->parallelFor(0, numElements, body);
+  }
+
+  void benchmarkHost(const Settings& settings, std::vector<Result>& results)
+  {
+    const SimdIsa isa = detectSimdIsa();
+    const auto kernel = getHeavyCalculationKernel(isa);
+    const std::string target = std::string("host ") + simdIsaName(isa);
+    const size_t largest = *std::max_element(settings.elements.begin(), settings.elements.end());
+    std::vector<float> a(4 * largest), b(4 * largest), c(largest);
+    fillArray(a, 1);
+    fillArray(b, 2);
+
+    for (size_t threads : settings.threads)
+    {
+      for (size_t numElements : settings.elements)
+      {
+        for (size_t maxLoopIdx : settings.loopDepths)
+        {
+          auto time = measure(settings, [&]()
+          {
+            runOnThreads(threads, numElements, [&](size_t iMin, size_t iMax)
+            {
+              kernel(a.data(), b.data(), c.data(), (int)iMin, (int)iMax, (int)numElements, (int)maxLoopIdx);
+            });
+            return true;
+          });
+          results.push_back(makeResult("HeavyCalculation", target, numElements, maxLoopIdx, 0, threads, time));
+        }
+
+        // DotProductHost of the sample: one float per float4 pair
+        auto time = measure(settings, [&]()
+        {
+          runOnThreads(threads, numElements, [&](size_t iMin, size_t iMax)
+          {
+            for (size_t i = iMin; i < iMax; ++i)
+              c[i] = dotProductScalar(a.data() + 4 * i, b.data() + 4 * i, 4);
+          });
+          return true;
+        });
+        results.push_back(makeResult("DotProduct", target, numElements, 0, 0, threads, time));
+      }
+    }
+  }
+
+  cl_device_id getFirstDevice()
+  {
+    cl_platform_id platformId = nullptr;
+    if (oclGetPlatformID(&platformId) != CL_SUCCESS)
+      return nullptr;
+    cl_uint numDevices = 0;
+    clGetDeviceIDs(platformId, CL_DEVICE_TYPE_ALL, 0, nullptr, &numDevices);
+    if (numDevices == 0)
+      return nullptr;
+    std::vector<cl_device_id> devices(numDevices);
+    clGetDeviceIDs(platformId, CL_DEVICE_TYPE_ALL, numDevices, devices.data(), nullptr);
+    return devices[0];
+  }
+
+  cl_program buildProgram(cl_context context, cl_device_id device, const char* source)
+  {
+    cl_program program = nullptr;
+    if (buildProgramCached(context, device, source, nullptr, programCacheDirectory(), program) != CL_SUCCESS)
+    {
+      oclLogBuildInfo(program, device);
+      if (program) clReleaseProgram(program);
+      return nullptr;
+    }
+    return program;
+  }
+
+  // Every launch of a device run is checked, so a failed one is reported instead of timed as an empty clFinish
+  bool launchAndFinish(cl_command_queue queue, cl_kernel kernel, const size_t* globalWorkSize, const size_t* localWorkSize,
+    cl_int& status)
+  {
+    status = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, globalWorkSize, localWorkSize, 0, nullptr, nullptr);
+    if (status == CL_SUCCESS)
+      status = clFinish(queue);
+    return status == CL_SUCCESS;
+  }
+
+  void reportFailure(const char* workload, size_t numElements, size_t maxLoopIdx, size_t localWorkSize, cl_int status)
+  {
+    std::cout << std::left << std::setw(18) << workload << std::right << "skipped: " << numElements << " elements, loop "
+      << maxLoopIdx << ", local " << localWorkSize << " failed with " << oclErrorString(status) << std::endl;
+  }
+
+  // Kernel time with the inputs resident on the device; local work sizes a kernel cannot take and
+  // configurations whose launch fails are skipped
+  void benchmarkDevice(const Settings& settings, cl_device_id device, std::vector<Result>& results)
+  {
+    char name[256] = {};
+    clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name), name, nullptr);
+    const std::string target = name;
+    cl_context context = clCreateContext(nullptr, 1, &device, nullptr, nullptr, nullptr);
+    cl_command_queue queue = clCreateCommandQueue(context, device, 0, nullptr);
+    cl_program heavyProgram = buildProgram(context, device, CL_PROGRAM_HEAVY_CALCULATION);
+    cl_program dotProgram = buildProgram(context, device, CL_PROGRAM_DOT_PRODUCT);
+    if (!heavyProgram || !dotProgram)
+    {
+      std::cout << "Program build failed, skipping the device runs" << std::endl;
+    }
+    else
+    {
+      cl_kernel heavyKernel = clCreateKernel(heavyProgram, "HeavyCalculation", nullptr);
+      cl_kernel dotKernel = clCreateKernel(dotProgram, "DotProduct", nullptr);
+      size_t heavyMax = 0, dotMax = 0;
+      clGetKernelWorkGroupInfo(heavyKernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(heavyMax), &heavyMax, nullptr);
+      clGetKernelWorkGroupInfo(dotKernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(dotMax), &dotMax, nullptr);
+
+      const size_t largest = *std::max_element(settings.elements.begin(), settings.elements.end());
+      const size_t roundedLargest = shrRoundUp(256, largest);
+      std::vector<float> a(4 * roundedLargest), b(4 * roundedLargest);
+      fillArray(a, 1);
+      fillArray(b, 2);
+      cl_mem bufferA = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * a.size(), a.data(), nullptr);
+      cl_mem bufferB = clCreateBuffer(context, CL_MEM_READ_ONLY | CL_MEM_COPY_HOST_PTR, sizeof(float) * b.size(), b.data(), nullptr);
+      cl_mem bufferC = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(float) * roundedLargest, nullptr, nullptr);
+      for (cl_kernel kernel : { heavyKernel, dotKernel })
+      {
+        clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)&bufferA);
+        clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)&bufferB);
+        clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)&bufferC);
+      }
+
+      for (size_t localWorkSize : settings.localWorkSizes)
+      {
+        const bool heavyTakes = !heavyMax || localWorkSize <= heavyMax;
+        const bool dotTakes = !dotMax || localWorkSize <= dotMax;
+        if (!heavyTakes && !dotTakes)
+          continue;
+        const size_t* localSize = localWorkSize ? &localWorkSize : nullptr;
+        for (size_t numElements : settings.elements)
+        {
+          // HeavyCalculation has no bounds check: the global size stays numElements, so
+          // local sizes that do not divide it are skipped
+          const cl_int iNumElements = (cl_int)numElements;
+          const bool heavyFits = heavyTakes && (localWorkSize == 0 || numElements % localWorkSize == 0);
+          for (size_t maxLoopIdx : heavyFits ? settings.loopDepths : std::vector<size_t>())
+          {
+            const cl_int iMaxLoopIdx = (cl_int)maxLoopIdx;
+            clSetKernelArg(heavyKernel, 3, sizeof(cl_int), (void*)&iNumElements);
+            clSetKernelArg(heavyKernel, 4, sizeof(cl_int), (void*)&iMaxLoopIdx);
+            cl_int status = CL_SUCCESS;
+            auto time = measure(settings, [&]()
+            {
+              return launchAndFinish(queue, heavyKernel, &numElements, localSize, status);
+            });
+            if (time.failed)
+              reportFailure("HeavyCalculation", numElements, maxLoopIdx, localWorkSize, status);
+            else
+              results.push_back(makeResult("HeavyCalculation", target, numElements, maxLoopIdx, localWorkSize, 0, time));
+          }
+
+          if (!dotTakes)
+            continue;
+          const size_t globalWorkSize = shrRoundUp(localWorkSize ? (int)localWorkSize : 1, numElements);
+          clSetKernelArg(dotKernel, 3, sizeof(cl_int), (void*)&iNumElements);
+          cl_int status = CL_SUCCESS;
+          auto time = measure(settings, [&]()
+          {
+            return launchAndFinish(queue, dotKernel, &globalWorkSize, localSize, status);
+          });
+          if (time.failed)
+            reportFailure("DotProduct", numElements, 0, localWorkSize, status);
+          else
+            results.push_back(makeResult("DotProduct", target, numElements, 0, localWorkSize, 0, time));
+        }
+      }
+
+      clReleaseMemObject(bufferA);
+      clReleaseMemObject(bufferB);
+      clReleaseMemObject(bufferC);
+      clReleaseKernel(heavyKernel);
+      clReleaseKernel(dotKernel);
+    }
+    if (heavyProgram) clReleaseProgram(heavyProgram);
+    if (dotProgram) clReleaseProgram(dotProgram);
+    clReleaseCommandQueue(queue);
+    clReleaseContext(context);
+  }
+
+  std::string jsonEscape(const std::string& text)
+  {
+    std::string escaped;
+    for (char c : text)
+    {
+      if (c == '"' || c == '\\')
+        escaped += '\\';
+      if ((unsigned char)c >= 0x20)
+        escaped += c;
+    }
+    return escaped;
+  }
+
+  void writeCsv(const std::string& fileName, const std::vector<Result>& results)
+  {
+    std::ofstream file(fileName);
+    file << "workload,target,elements,loop_depth,local_work_size,threads,median_ms,min_ms,mean_ms,stddev_ms,"
+      "rejected,elements_per_s,gb_per_s,gflop_per_s\n";
+    for (const auto& result : results)
+    {
+      file << result.workload << ",\"" << result.target << "\"," << result.numElements << "," << result.maxLoopIdx << ","
+        << result.localWorkSize << "," << result.threads << "," << result.time.medianMs << "," << result.time.minMs << ","
+        << result.time.meanMs << "," << result.time.stddevMs << "," << result.time.rejected << ","
+        << result.elementsPerSecond << "," << result.gigabytesPerSecond << "," << result.gigaflopsPerSecond << "\n";
+    }
+  }
+
+  void writeJson(const std::string& fileName, const Settings& settings, const std::vector<Result>& results)
+  {
+    std::ofstream file(fileName);
+    file << "{\n  \"warmup\": " << settings.warmup << ",\n  \"runs\": " << settings.runs << ",\n  \"results\": [";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+      const auto& result = results[i];
+      file << (i ? "," : "") << "\n    {\"workload\": \"" << result.workload << "\", \"target\": \"" << jsonEscape(result.target)
+        << "\", \"elements\": " << result.numElements << ", \"loop_depth\": " << result.maxLoopIdx
+        << ", \"local_work_size\": " << result.localWorkSize << ", \"threads\": " << result.threads
+        << ", \"median_ms\": " << result.time.medianMs << ", \"min_ms\": " << result.time.minMs
+        << ", \"mean_ms\": " << result.time.meanMs << ", \"stddev_ms\": " << result.time.stddevMs
+        << ", \"rejected\": " << result.time.rejected << ", \"elements_per_s\": " << result.elementsPerSecond
+        << ", \"gb_per_s\": " << result.gigabytesPerSecond << ", \"gflop_per_s\": " << result.gigaflopsPerSecond << "}";
+    }
+    file << "\n  ]\n}\n";
+  }
+}
+
+// *********************************************************************
+int main(int argc, char** argv)
+{
+  const auto settings = parseSettings(argc, (const char**)argv);
+  std::vector<Result> results;
+
+  printHeader();
+  benchmarkHost(settings, results);
+  if (!settings.hostOnly)
+  {
+    cl_device_id device = getFirstDevice();
+    if (device)
+      benchmarkDevice(settings, device, results);
+    else
+      std::cout << "No OpenCL device found, host results only" << std::endl;
+  }
+
+  writeCsv(settings.csvFile, results);
+  writeJson(settings.jsonFile, settings, results);
+  std::cout << results.size() << " results written to " << settings.csvFile << " and " << settings.jsonFile << std::endl;
+  return 0;
+}
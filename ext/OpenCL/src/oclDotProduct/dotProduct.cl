@@ -0,0 +1,23 @@
+const char * CL_PROGRAM_DOT_PRODUCT = R"( 
+// One float4 dot product per work item
+ __kernel void DotProduct (__global const float4* a, __global const float4* b, __global float* c, int iNumElements)
+{
+    int i = get_global_id(0);
+    if (i >= iNumElements)
+      return;
+
+   c[i] = dot(a[i], b[i]);
+
+}
+
+// Several float4 dot products per work item, grid-stride so neighbouring work items stay on neighbouring elements;
+// the global size only needs to cover iNumElements / elements per work item
+ __kernel void DotProductMulti (__global const float4* a, __global const float4* b, __global float* c, int iNumElements)
+{
+   for(int i = get_global_id(0); i < iNumElements; i += get_global_size(0))
+   {
+     c[i] = dot(a[i], b[i]);
+   }
+
+}
+)";
\ No newline at end of file
@@ -0,0 +1,53 @@
+const char * CL_PROGRAM_DOT_PRODUCT_REDUCTION = R"( 
+// First pass: every work item accumulates a grid-stride run of float4 dot products,
+// then the work-group tree-reduces them in local memory to one partial sum per group
+// (the local size must be a power of two)
+ __kernel void DotProductPartial (__global const float4* a, __global const float4* b, __global float* partialSums,
+    __local float* scratch, int iNumElements)
+{
+    int lid = get_local_id(0);
+
+   float sum = 0.0f;
+   for(int i = get_global_id(0); i < iNumElements; i += get_global_size(0))
+   {
+     sum += dot(a[i], b[i]);
+   }
+   scratch[lid] = sum;
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for(int offset = get_local_size(0) / 2; offset > 0; offset >>= 1)
+   {
+     if (lid < offset)
+       scratch[lid] += scratch[lid + offset];
+     barrier(CLK_LOCAL_MEM_FENCE);
+   }
+   if (lid == 0)
+     partialSums[get_group_id(0)] = scratch[0];
+
+}
+
+// Second pass, a single work-group: the partial sums to the scalar result[0]
+ __kernel void DotProductFinal (__global const float* partialSums, __global float* result,
+    __local float* scratch, int numPartialSums)
+{
+    int lid = get_local_id(0);
+
+   float sum = 0.0f;
+   for(int i = lid; i < numPartialSums; i += get_local_size(0))
+   {
+     sum += partialSums[i];
+   }
+   scratch[lid] = sum;
+   barrier(CLK_LOCAL_MEM_FENCE);
+
+   for(int offset = get_local_size(0) / 2; offset > 0; offset >>= 1)
+   {
+     if (lid < offset)
+       scratch[lid] += scratch[lid + offset];
+     barrier(CLK_LOCAL_MEM_FENCE);
+   }
+   if (lid == 0)
+     result[0] = scratch[0];
+
+}
+)";
\ No newline at end of file
@@ -0,0 +1,278 @@
+#include "dotProductReduction.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <random>
+
+#include "heavyCalculationSimd.h"
+#include "perfCounters.h"
+#include "threadPool.h"
+
+#include "dotProductReduction.cl"
+
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+
+#if defined(_M_X64) || defined(__x86_64__)
+#define DOT_PRODUCT_SSE
+#include <emmintrin.h>
+#endif
+
+namespace
+{
+  // Partial sums of the first pass; more groups than this only lengthen the grid-stride loops
+  const size_t MAX_GROUPS = 1024;
+  const size_t MAX_LOCAL_WORK_SIZE = 256;
+
+  using DotProductKernel = float (*)(const float* a, const float* b, size_t n);
+
+  // Installed RAM in bytes, 0 when unknown
+  unsigned long long physicalMemoryBytes()
+  {
+#ifdef _WIN32
+    MEMORYSTATUSEX status;
+    status.dwLength = sizeof(status);
+    return GlobalMemoryStatusEx(&status) ? status.ullTotalPhys : 0;
+#else
+    const long pages = sysconf(_SC_PHYS_PAGES);
+    const long pageSize = sysconf(_SC_PAGE_SIZE);
+    return (pages > 0 && pageSize > 0) ? (unsigned long long)pages * pageSize : 0;
+#endif
+  }
+
+  DotProductKernel getDotProductKernel()
+  {
+#ifdef DOT_PRODUCT_SSE
+    switch (detectSimdIsa())
+    {
+    case SimdIsa::AVX2:
+    case SimdIsa::AVX512:
+      return dotProductAvx2;
+    default:
+      return dotProductSse;
+    }
+#else
+    return dotProductScalar;
+#endif
+  }
+}
+
+float dotProductScalar(const float* a, const float* b, size_t n)
+{
+  float sum = 0.0f;
+  for (size_t i = 0; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+
+#ifdef DOT_PRODUCT_SSE
+// SSE2 is part of x86-64, so this kernel needs no target switch
+float dotProductSse(const float* a, const float* b, size_t n)
+{
+  __m128 acc0 = _mm_setzero_ps(), acc1 = _mm_setzero_ps();
+  __m128 acc2 = _mm_setzero_ps(), acc3 = _mm_setzero_ps();
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16)
+  {
+    acc0 = _mm_add_ps(acc0, _mm_mul_ps(_mm_loadu_ps(a + i), _mm_loadu_ps(b + i)));
+    acc1 = _mm_add_ps(acc1, _mm_mul_ps(_mm_loadu_ps(a + i + 4), _mm_loadu_ps(b + i + 4)));
+    acc2 = _mm_add_ps(acc2, _mm_mul_ps(_mm_loadu_ps(a + i + 8), _mm_loadu_ps(b + i + 8)));
+    acc3 = _mm_add_ps(acc3, _mm_mul_ps(_mm_loadu_ps(a + i + 12), _mm_loadu_ps(b + i + 12)));
+  }
+  __m128 acc = _mm_add_ps(_mm_add_ps(acc0, acc1), _mm_add_ps(acc2, acc3));
+  acc = _mm_add_ps(acc, _mm_movehl_ps(acc, acc));
+  acc = _mm_add_ss(acc, _mm_shuffle_ps(acc, acc, 1));
+  float sum = _mm_cvtss_f32(acc);
+  for (; i < n; i++)
+    sum += a[i] * b[i];
+  return sum;
+}
+#else
+float dotProductSse(const float* a, const float* b, size_t n)
+{
+  return dotProductScalar(a, b, n);
+}
+#endif
+
+double dotProductHost(const float* a, const float* b, size_t n)
+{
+  static const auto kernel = getDotProductKernel();
+  std::mutex mutex;
+  double total = 0.0;
+  ThreadPool::instance().parallelFor(0, n, [&](size_t iMin, size_t iMax)
+  {
+    PerfScope perf("DotProductHost");
+    const double sum = kernel(a + iMin, b + iMin, iMax - iMin);
+    std::lock_guard<std::mutex> lock(mutex);
+    total += sum;
+  });
+  return total;
+}
+
+DotProductReducer::DotProductReducer(cl_context context, cl_device_id device)
+{
+  size_t programSize = strlen(CL_PROGRAM_DOT_PRODUCT_REDUCTION);
+  program_ = clCreateProgramWithSource(context, 1, &CL_PROGRAM_DOT_PRODUCT_REDUCTION, &programSize, nullptr);
+  if (clBuildProgram(program_, 1, &device, nullptr, nullptr, nullptr) != CL_SUCCESS)
+  {
+    oclLogBuildInfo(program_, device);
+    return;
+  }
+  partialKernel_ = clCreateKernel(program_, "DotProductPartial", nullptr);
+  finalKernel_ = clCreateKernel(program_, "DotProductFinal", nullptr);
+
+  // The tree reduction halves the group, so the local size is the largest power of two the kernels allow
+  size_t kernelMax = MAX_LOCAL_WORK_SIZE;
+  for (cl_kernel kernel : { partialKernel_, finalKernel_ })
+  {
+    size_t size = 0;
+    clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(size), &size, nullptr);
+    if (size > 0)
+      kernelMax = std::min(kernelMax, size);
+  }
+  localWorkSize_ = 1;
+  while (localWorkSize_ * 2 <= kernelMax)
+    localWorkSize_ *= 2;
+
+  partialBuffer_ = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_float) * MAX_GROUPS, nullptr, nullptr);
+  resultBuffer_ = clCreateBuffer(context, CL_MEM_WRITE_ONLY, sizeof(cl_float), nullptr, nullptr);
+}
+
+DotProductReducer::~DotProductReducer()
+{
+  if (partialKernel_) clReleaseKernel(partialKernel_);
+  if (finalKernel_) clReleaseKernel(finalKernel_);
+  if (program_) clReleaseProgram(program_);
+  if (partialBuffer_) clReleaseMemObject(partialBuffer_);
+  if (resultBuffer_) clReleaseMemObject(resultBuffer_);
+}
+
+cl_int DotProductReducer::reduce(cl_command_queue queue, cl_mem a, cl_mem b, size_t numElements, float& sum,
+  std::vector<float>* partialSums)
+{
+  sum = 0.0f;
+  if (!valid())
+    return CL_INVALID_PROGRAM_EXECUTABLE;
+
+  const size_t numGroups = std::max<size_t>(1, std::min(MAX_GROUPS, (numElements + localWorkSize_ - 1) / localWorkSize_));
+  const size_t globalWorkSize = numGroups * localWorkSize_;
+  cl_int iNumElements = (cl_int)numElements;
+  cl_int numPartialSums = (cl_int)numGroups;
+
+  cl_int status = clSetKernelArg(partialKernel_, 0, sizeof(cl_mem), (void*)&a);
+  status |= clSetKernelArg(partialKernel_, 1, sizeof(cl_mem), (void*)&b);
+  status |= clSetKernelArg(partialKernel_, 2, sizeof(cl_mem), (void*)&partialBuffer_);
+  status |= clSetKernelArg(partialKernel_, 3, sizeof(cl_float) * localWorkSize_, nullptr);
+  status |= clSetKernelArg(partialKernel_, 4, sizeof(cl_int), (void*)&iNumElements);
+  status |= clSetKernelArg(finalKernel_, 0, sizeof(cl_mem), (void*)&partialBuffer_);
+  status |= clSetKernelArg(finalKernel_, 1, sizeof(cl_mem), (void*)&resultBuffer_);
+  status |= clSetKernelArg(finalKernel_, 2, sizeof(cl_float) * localWorkSize_, nullptr);
+  status |= clSetKernelArg(finalKernel_, 3, sizeof(cl_int), (void*)&numPartialSums);
+  if (status != CL_SUCCESS)
+    return status;
+
+  status = clEnqueueNDRangeKernel(queue, partialKernel_, 1, nullptr, &globalWorkSize, &localWorkSize_, 0, nullptr, nullptr);
+  if (status != CL_SUCCESS)
+    return status;
+  status = clEnqueueNDRangeKernel(queue, finalKernel_, 1, nullptr, &localWorkSize_, &localWorkSize_, 0, nullptr, nullptr);
+  if (status != CL_SUCCESS)
+    return status;
+  if (partialSums)
+  {
+    partialSums->resize(numGroups);
+    status = clEnqueueReadBuffer(queue, partialBuffer_, CL_FALSE, 0, sizeof(cl_float) * numGroups, partialSums->data(), 0, nullptr, nullptr);
+    if (status != CL_SUCCESS)
+      return status;
+  }
+  float result = 0.0f;
+  status = clEnqueueReadBuffer(queue, resultBuffer_, CL_TRUE, 0, sizeof(cl_float), &result, 0, nullptr, nullptr);
+  if (status == CL_SUCCESS)
+    sum = result;
+  return status;
+}
+
+void benchmarkDotProductReduction(cl_context context, cl_device_id device, cl_command_queue queue)
+{
+  const int REPETITIONS = 5;
+  const size_t MIN_ELEMENTS = 1 << 16;
+
+  // Two float4 inputs have to fit in one allocation each and together in global memory
+  cl_ulong maxAlloc = 0, globalMem = 0;
+  clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, nullptr);
+  clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMem), &globalMem, nullptr);
+  size_t maxElements = (size_t)(std::min(maxAlloc, globalMem / 2) / sizeof(cl_float4));
+  // The host keeps its own copy of both inputs, and a CPU device takes its buffers from the same RAM:
+  // the four arrays stay within half of it
+  const unsigned long long physicalMemory = physicalMemoryBytes();
+  if (physicalMemory > 0)
+    maxElements = std::min<size_t>(maxElements, (size_t)(physicalMemory / 2 / (4 * sizeof(cl_float4))));
+  // The kernels index with int
+  const size_t limit = std::min<size_t>(maxElements, 1u << 30);
+  if (limit < MIN_ELEMENTS)
+    return;
+  size_t largest = MIN_ELEMENTS;
+  while (largest * 2 <= limit)
+    largest *= 2;
+
+  DotProductReducer reducer(context, device);
+  if (!reducer.valid())
+    return;
+  std::vector<float> a(4 * largest), b(4 * largest);
+  ThreadPool::instance().parallelFor(0, a.size(), [&](size_t iMin, size_t iMax)
+  {
+    std::minstd_rand generator((unsigned int)iMin + 1);
+    const float scale = 1.0f / (float)generator.max();
+    for (size_t i = iMin; i < iMax; ++i)
+    {
+      a[i] = scale * generator();
+      b[i] = scale * generator();
+    }
+  });
+  cl_mem bufferA = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(cl_float4) * largest, nullptr, nullptr);
+  cl_mem bufferB = clCreateBuffer(context, CL_MEM_READ_ONLY, sizeof(cl_float4) * largest, nullptr, nullptr);
+  clEnqueueWriteBuffer(queue, bufferA, CL_FALSE, 0, sizeof(cl_float4) * largest, a.data(), 0, nullptr, nullptr);
+  clEnqueueWriteBuffer(queue, bufferB, CL_TRUE, 0, sizeof(cl_float4) * largest, b.data(), 0, nullptr, nullptr);
+
+  auto ms = [](std::chrono::steady_clock::time_point begin)
+  {
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+  };
+
+  std::cout << "Dot product reduction, inputs resident on the device" << std::endl;
+  std::cout << std::setw(12) << "float4" << std::setw(14) << "device, ms" << std::setw(10) << "GB/s"
+    << std::setw(12) << "host, ms" << std::setw(10) << "GB/s" << std::setw(14) << "rel. diff" << std::endl;
+  for (size_t numElements = MIN_ELEMENTS; numElements <= largest; numElements *= 2)
+  {
+    double deviceMs = 0.0, hostMs = 0.0, hostSum = 0.0;
+    float deviceSum = 0.0f;
+    cl_int status = reducer.reduce(queue, bufferA, bufferB, numElements, deviceSum);
+    for (int rep = 0; rep < REPETITIONS && status == CL_SUCCESS; ++rep)
+    {
+      auto begin = std::chrono::steady_clock::now();
+      status = reducer.reduce(queue, bufferA, bufferB, numElements, deviceSum);
+      const double device = ms(begin);
+      begin = std::chrono::steady_clock::now();
+      hostSum = dotProductHost(a.data(), b.data(), 4 * numElements);
+      const double host = ms(begin);
+      deviceMs = (rep == 0) ? device : std::min(deviceMs, device);
+      hostMs = (rep == 0) ? host : std::min(hostMs, host);
+    }
+    if (status != CL_SUCCESS)
+    {
+      std::cout << std::setw(12) << numElements << "  device reduction failed: " << oclErrorString(status) << std::endl;
+      break;
+    }
+    const double bytes = 2.0 * sizeof(cl_float4) * numElements;
+    std::cout << std::setw(12) << numElements << std::setw(14) << deviceMs << std::setw(10) << bytes / deviceMs * 1.e-6
+      << std::setw(12) << hostMs << std::setw(10) << bytes / hostMs * 1.e-6
+      << std::setw(14) << fabs(deviceSum - hostSum) / std::max(fabs(hostSum), 1.e-30) << std::endl;
+  }
+
+  clReleaseMemObject(bufferA);
+  clReleaseMemObject(bufferB);
+}
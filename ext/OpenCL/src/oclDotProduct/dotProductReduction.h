@@ -0,0 +1,46 @@
+#pragma once
+
+#include <vector>
+
+#include <oclUtils.h>
+
+// Scalar dot product of the DotProduct sample, on the device and on the host.
+// The sample's inputs are float4 arrays; the scalar is the sum of the numElements float4 dot products.
+
+// Host: the thread pool splits the range, every chunk runs the widest SIMD kernel the CPU supports
+// and the chunk sums are added in double. a and b hold n floats.
+double dotProductHost(const float* a, const float* b, size_t n);
+
+// Per-chunk host kernels, single-threaded
+float dotProductScalar(const float* a, const float* b, size_t n);
+float dotProductSse(const float* a, const float* b, size_t n);
+float dotProductAvx2(const float* a, const float* b, size_t n);
+
+// Device: a work-group tree reduction in local memory, then a single-group pass over the partial sums.
+// Only the partial sums (one per group) or just the scalar are read back instead of all results.
+class DotProductReducer
+{
+public:
+  DotProductReducer(cl_context context, cl_device_id device);
+  ~DotProductReducer();
+  DotProductReducer(const DotProductReducer&) = delete;
+  DotProductReducer& operator=(const DotProductReducer&) = delete;
+
+  bool valid() const { return finalKernel_ != 0; }
+
+  // Sum of dot(a[i], b[i]) over the first numElements float4 of a and b into sum. partialSums, when given,
+  // receives the per-work-group sums as well. Returns the first failing CL status, or CL_SUCCESS.
+  cl_int reduce(cl_command_queue queue, cl_mem a, cl_mem b, size_t numElements, float& sum,
+    std::vector<float>* partialSums = nullptr);
+
+private:
+  size_t localWorkSize_ = 0;
+  cl_program program_ = 0;
+  cl_kernel partialKernel_ = 0;
+  cl_kernel finalKernel_ = 0;
+  cl_mem partialBuffer_ = 0;
+  cl_mem resultBuffer_ = 0;
+};
+
+// Device and host reduction time and GB/s for growing sizes, up to what the device and half the RAM can hold
+void benchmarkDotProductReduction(cl_context context, cl_device_id device, cl_command_queue queue);
@@ -0,0 +1,152 @@
+#include "eventProfiler.h"
+#include "traceExporter.h"
+
+#include <algorithm>
+
+namespace
+{
+  const char* commandKind(cl_command_type type)
+  {
+    switch (type)
+    {
+    case CL_COMMAND_NDRANGE_KERNEL:
+    case CL_COMMAND_TASK:
+      return "kernel";
+    case CL_COMMAND_WRITE_BUFFER:
+    case CL_COMMAND_READ_BUFFER:
+    case CL_COMMAND_COPY_BUFFER:
+    case CL_COMMAND_MAP_BUFFER:
+    case CL_COMMAND_UNMAP_MEM_OBJECT:
+      return "transfer";
+    default:
+      return "other";
+    }
+  }
+
+  struct Interval
+  {
+    cl_ulong start;
+    cl_ulong end;
+  };
+
+  // Length of the union of the intervals, overlapping commands count once
+  cl_ulong unionLength(std::vector<Interval> intervals)
+  {
+    std::sort(intervals.begin(), intervals.end(), [](const Interval& x, const Interval& y) { return x.start < y.start; });
+    cl_ulong busy = 0, coveredUntil = 0;
+    for (const auto& interval : intervals)
+    {
+      const cl_ulong from = std::max(interval.start, coveredUntil);
+      if (interval.end > from)
+      {
+        busy += interval.end - from;
+        coveredUntil = interval.end;
+      }
+    }
+    return busy;
+  }
+}
+
+EventProfiler& EventProfiler::instance()
+{
+  static EventProfiler profiler;
+  return profiler;
+}
+
+EventProfiler::~EventProfiler()
+{
+  // Commands of scopes that never closed
+  for (auto& command : commands_)
+  {
+    if (command.event)
+      clReleaseEvent(command.event);
+  }
+}
+
+cl_event* EventProfiler::track(const std::string& label)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (openScopes_ == 0)
+    return nullptr;
+  commands_.emplace_back();
+  commands_.back().label = label;
+  return &commands_.back().event;
+}
+
+size_t EventProfiler::beginScope()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  ++openScopes_;
+  return base_ + commands_.size();
+}
+
+size_t EventProfiler::endScope()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  --openScopes_;
+  return base_ + commands_.size();
+}
+
+std::vector<EventProfiler::CommandTimes> EventProfiler::collect(size_t begin, size_t end)
+{
+  std::vector<CommandTimes> collected;
+  std::lock_guard<std::mutex> lock(mutex_);
+  for (size_t i = std::max(begin, base_); i < std::min(end, base_ + commands_.size()); ++i)
+  {
+    auto& command = commands_[i - base_];
+    if (command.collected || !command.event)
+      continue;
+    command.collected = true;
+
+    clWaitForEvents(1, &command.event);
+    cl_command_type type = 0;
+    CommandTimes times = { command.label, "other", 0, 0, 0, 0 };
+    clGetEventInfo(command.event, CL_EVENT_COMMAND_TYPE, sizeof(type), &type, nullptr);
+    clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_QUEUED, sizeof(times.queued), &times.queued, nullptr);
+    clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_SUBMIT, sizeof(times.submit), &times.submit, nullptr);
+    clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_START, sizeof(times.start), &times.start, nullptr);
+    clGetEventProfilingInfo(command.event, CL_PROFILING_COMMAND_END, sizeof(times.end), &times.end, nullptr);
+    cl_command_queue queue = 0;
+    clGetEventInfo(command.event, CL_EVENT_COMMAND_QUEUE, sizeof(queue), &queue, nullptr);
+    clReleaseEvent(command.event);
+    command.event = 0;
+
+    times.kind = commandKind(type);
+    TraceExporter::instance().addDeviceCommand(queue, times.label, times.kind, times.queued, times.submit, times.start, times.end);
+    collected.push_back(times);
+  }
+  // Commands still waiting for an enclosing scope keep the ones after them
+  while (!commands_.empty() && commands_.front().collected)
+  {
+    commands_.pop_front();
+    ++base_;
+  }
+  return collected;
+}
+
+EventProfiler::Busy EventProfiler::busyTime(const std::vector<CommandTimes>& commands)
+{
+  std::vector<Interval> all, kernels, transfers;
+  for (const auto& command : commands)
+  {
+    all.push_back({ command.start, command.end });
+    if (command.kind == std::string("kernel"))
+      kernels.push_back({ command.start, command.end });
+    else if (command.kind == std::string("transfer"))
+      transfers.push_back({ command.start, command.end });
+  }
+  Busy busy;
+  busy.kernel = unionLength(kernels);
+  busy.transfer = unionLength(transfers);
+  busy.all = unionLength(all);
+  return busy;
+}
+
+cl_event* profileKernelEvent(cl_kernel kernel)
+{
+  if (!EventProfiler::instance().enabled())
+    return nullptr;
+  char name[256] = {};
+  clGetKernelInfo(kernel, CL_KERNEL_FUNCTION_NAME, sizeof(name) - 1, name, nullptr);
+  return EventProfiler::instance().track(name);
+}
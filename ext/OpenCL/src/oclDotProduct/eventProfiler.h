@@ -0,0 +1,79 @@
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <oclUtils.h>
+
+// Device-side timing of the enqueued commands, reported together with the host Timer scopes.
+// When enabled, queues are created with CL_QUEUE_PROFILING_ENABLE and every write, kernel and read
+// passes profileEvent()/profileKernelEvent() as its event. Timer::report() collects the commands enqueued
+// during every scope, queued/submit/start/end of each, and splits its wall time into device kernel
+// time, transfer time and host overhead. Disabled, the helpers return nullptr and cost nothing.
+// Commands are numbered from the start of the run; collected ones are dropped from the front of the list,
+// and commands enqueued while no Timer scope is open are not tracked at all, since nothing would collect them.
+class EventProfiler
+{
+public:
+  static EventProfiler& instance();
+
+  void setEnabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+  cl_command_queue_properties queueProperties() const { return enabled_ ? CL_QUEUE_PROFILING_ENABLE : 0; }
+
+  ~EventProfiler();
+
+  // Event slot for the next command, or nullptr when profiling is off or no Timer scope is open
+  cl_event* track(const std::string& label);
+
+  // Number of commands tracked so far, taken by a Timer when it opens and closes;
+  // the scope owns the commands between its two marks
+  size_t beginScope();
+  size_t endScope();
+
+  struct CommandTimes
+  {
+    std::string label;
+    const char* kind;  // "kernel", "transfer" or "other"
+    cl_ulong queued;
+    cl_ulong submit;
+    cl_ulong start;
+    cl_ulong end;
+  };
+  // Waits for the commands tracked in [begin, end) that are not collected yet, releases their events
+  // and returns their times (also passed on to the trace, see traceExporter.h)
+  std::vector<CommandTimes> collect(size_t begin, size_t end);
+
+  // Device time of a set of commands in ns, overlapping commands counted once
+  struct Busy
+  {
+    cl_ulong kernel = 0;
+    cl_ulong transfer = 0;
+    cl_ulong all = 0;
+  };
+  static Busy busyTime(const std::vector<CommandTimes>& commands);
+
+private:
+  struct Command
+  {
+    std::string label;
+    cl_event event = 0;
+    bool collected = false;
+  };
+
+  bool enabled_ = false;
+  std::mutex mutex_;
+  std::deque<Command> commands_;  // a deque keeps the event slots in place as it grows and shrinks at the front
+  size_t base_ = 0;  // number of the front command
+  size_t openScopes_ = 0;
+};
+
+inline cl_event* profileEvent(const char* label)
+{
+  return EventProfiler::instance().enabled() ? EventProfiler::instance().track(label) : nullptr;
+}
+
+// Labelled with the kernel function name
+cl_event* profileKernelEvent(cl_kernel kernel);
@@ -0,0 +1,83 @@
+// AVX2 + FMA HeavyCalculation kernel, 8 lanes.
+// MSVC builds this file with /arch:AVX2, GCC/Clang get the target through the pragma below.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+#include <math.h>
+
+#if defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2,fma")
+#endif
+
+#include <immintrin.h>
+#include "heavyCalculationSimdImpl.h"
+
+namespace
+{
+  struct Avx2Ops
+  {
+    static const int WIDTH = 8;
+    using vf = __m256;
+    using vi = __m256i;
+
+    static vf load(const float* p) { return _mm256_loadu_ps(p); }
+    static vf set1(float x) { return _mm256_set1_ps(x); }
+    static vf add(vf x, vf y) { return _mm256_add_ps(x, y); }
+    static vf mul(vf x, vf y) { return _mm256_mul_ps(x, y); }
+    static vf fmadd(vf x, vf y, vf z) { return _mm256_fmadd_ps(x, y, z); }
+    static vf ramp(float base) { return _mm256_add_ps(_mm256_set1_ps(base), _mm256_setr_ps(0, 1, 2, 3, 4, 5, 6, 7)); }
+    static vi addOne(vi q) { return _mm256_add_epi32(q, _mm256_set1_epi32(1)); }
+
+    static float reduceAdd(vf x)
+    {
+      __m128 sum = _mm_add_ps(_mm256_castps256_ps128(x), _mm256_extractf128_ps(x, 1));
+      sum = _mm_add_ps(sum, _mm_movehl_ps(sum, sum));
+      sum = _mm_add_ss(sum, _mm_movehdup_ps(sum));
+      return _mm_cvtss_f32(sum);
+    }
+
+    static void reduceHalf(__m128 x, __m128& r, __m128i& q)
+    {
+      __m256d d = _mm256_cvtps_pd(x);
+      __m256d qd = _mm256_round_pd(_mm256_mul_pd(d, _mm256_set1_pd(TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+      d = _mm256_fnmadd_pd(qd, _mm256_set1_pd(PIO2_HI), d);
+      d = _mm256_fnmadd_pd(qd, _mm256_set1_pd(PIO2_LO), d);
+      r = _mm256_cvtpd_ps(d);
+      q = _mm256_cvtpd_epi32(qd);
+    }
+
+    static void reduce(vf x, vf& r, vi& q)
+    {
+      __m128 rLo, rHi;
+      __m128i qLo, qHi;
+      reduceHalf(_mm256_castps256_ps128(x), rLo, qLo);
+      reduceHalf(_mm256_extractf128_ps(x, 1), rHi, qHi);
+      r = _mm256_insertf128_ps(_mm256_castps128_ps256(rLo), rHi, 1);
+      q = _mm256_inserti128_si256(_mm256_castsi128_si256(qLo), qHi, 1);
+    }
+
+    static vf selectOdd(vi q, vf ifOdd, vf ifEven)
+    {
+      __m256i odd = _mm256_slli_epi32(q, 31);
+      return _mm256_blendv_ps(ifEven, ifOdd, _mm256_castsi256_ps(odd));
+    }
+
+    static vf negateIfBit1(vf x, vi q)
+    {
+      __m256i sign = _mm256_slli_epi32(_mm256_and_si256(q, _mm256_set1_epi32(2)), 30);
+      return _mm256_xor_ps(x, _mm256_castsi256_ps(sign));
+    }
+  };
+}
+
+void HeavyCalculationAvx2(const float* a, const float* b, float* c,
+  int iMin, int iMax, int numElements, int maxLoopIdx)
+{
+  heavyCalculationRange<Avx2Ops>(a, b, c, iMin, iMax, numElements, maxLoopIdx);
+}
+
+#if defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -0,0 +1,80 @@
+// AVX-512F HeavyCalculation kernel, 16 lanes.
+// MSVC builds this file with /arch:AVX512, GCC/Clang get the target through the pragma below.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+#include <math.h>
+
+#if defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+#include <immintrin.h>
+#include "heavyCalculationSimdImpl.h"
+
+namespace
+{
+  struct Avx512Ops
+  {
+    static const int WIDTH = 16;
+    using vf = __m512;
+    using vi = __m512i;
+
+    static vf load(const float* p) { return _mm512_loadu_ps(p); }
+    static vf set1(float x) { return _mm512_set1_ps(x); }
+    static vf add(vf x, vf y) { return _mm512_add_ps(x, y); }
+    static vf mul(vf x, vf y) { return _mm512_mul_ps(x, y); }
+    static vf fmadd(vf x, vf y, vf z) { return _mm512_fmadd_ps(x, y, z); }
+    static vi addOne(vi q) { return _mm512_add_epi32(q, _mm512_set1_epi32(1)); }
+    static float reduceAdd(vf x) { return _mm512_reduce_add_ps(x); }
+
+    static vf ramp(float base)
+    {
+      return _mm512_add_ps(_mm512_set1_ps(base),
+        _mm512_setr_ps(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15));
+    }
+
+    static void reduceHalf(__m256 x, __m256& r, __m256i& q)
+    {
+      __m512d d = _mm512_cvtps_pd(x);
+      __m512d qd = _mm512_roundscale_pd(_mm512_mul_pd(d, _mm512_set1_pd(TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+      d = _mm512_fnmadd_pd(qd, _mm512_set1_pd(PIO2_HI), d);
+      d = _mm512_fnmadd_pd(qd, _mm512_set1_pd(PIO2_LO), d);
+      r = _mm512_cvtpd_ps(d);
+      q = _mm512_cvtpd_epi32(qd);
+    }
+
+    static void reduce(vf x, vf& r, vi& q)
+    {
+      __m256 rLo, rHi;
+      __m256i qLo, qHi;
+      reduceHalf(_mm512_castps512_ps256(x), rLo, qLo);
+      reduceHalf(_mm256_castpd_ps(_mm512_extractf64x4_pd(_mm512_castps_pd(x), 1)), rHi, qHi);
+      r = _mm512_castpd_ps(_mm512_insertf64x4(_mm512_castps_pd(_mm512_castps256_ps512(rLo)), _mm256_castps_pd(rHi), 1));
+      q = _mm512_inserti64x4(_mm512_castsi256_si512(qLo), qHi, 1);
+    }
+
+    static vf selectOdd(vi q, vf ifOdd, vf ifEven)
+    {
+      return _mm512_mask_blend_ps(_mm512_test_epi32_mask(q, _mm512_set1_epi32(1)), ifEven, ifOdd);
+    }
+
+    static vf negateIfBit1(vf x, vi q)
+    {
+      __m512i sign = _mm512_slli_epi32(_mm512_and_si512(q, _mm512_set1_epi32(2)), 30);
+      return _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(x), sign));
+    }
+  };
+}
+
+void HeavyCalculationAvx512(const float* a, const float* b, float* c,
+  int iMin, int iMax, int numElements, int maxLoopIdx)
+{
+  heavyCalculationRange<Avx512Ops>(a, b, c, iMin, iMax, numElements, maxLoopIdx);
+}
+
+#if defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -0,0 +1,144 @@
+#include "heavyCalculationSimd.h"
+
+#include <math.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+#define HEAVY_CALCULATION_X86
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+
+// Defined in the per-ISA translation units
+void HeavyCalculationSse4(const float* a, const float* b, float* c, int iMin, int iMax, int numElements, int maxLoopIdx);
+void HeavyCalculationAvx2(const float* a, const float* b, float* c, int iMin, int iMax, int numElements, int maxLoopIdx);
+void HeavyCalculationAvx512(const float* a, const float* b, float* c, int iMin, int iMax, int numElements, int maxLoopIdx);
+#endif
+
+namespace
+{
+#ifdef HEAVY_CALCULATION_X86
+  void cpuid(unsigned int leaf, unsigned int subLeaf, unsigned int regs[4])
+  {
+#if defined(_MSC_VER)
+    int info[4];
+    __cpuidex(info, (int)leaf, (int)subLeaf);
+    for (int i = 0; i < 4; i++)
+      regs[i] = (unsigned int)info[i];
+#else
+    regs[0] = regs[1] = regs[2] = regs[3] = 0;
+    __get_cpuid_count(leaf, subLeaf, &regs[0], &regs[1], &regs[2], &regs[3]);
+#endif
+  }
+
+  // XCR0: which register states the OS saves on context switch
+  unsigned long long xgetbv0()
+  {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned int eax, edx;
+    __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+    return ((unsigned long long)edx << 32) | eax;
+#endif
+  }
+
+  SimdIsa queryCpu()
+  {
+    unsigned int leaf1[4], leaf7[4];
+    cpuid(0, 0, leaf1);
+    const unsigned int maxLeaf = leaf1[0];
+    cpuid(1, 0, leaf1);
+    if (maxLeaf >= 7)
+      cpuid(7, 0, leaf7);
+    else
+      leaf7[0] = leaf7[1] = leaf7[2] = leaf7[3] = 0;
+
+    const bool sse41 = (leaf1[2] >> 19) & 1;
+    const bool osxsave = (leaf1[2] >> 27) & 1;
+    const bool avx = (leaf1[2] >> 28) & 1;
+    const bool fma = (leaf1[2] >> 12) & 1;
+    const bool avx2 = (leaf7[1] >> 5) & 1;
+    const bool avx512f = (leaf7[1] >> 16) & 1;
+    const unsigned long long xcr0 = osxsave ? xgetbv0() : 0;
+    const bool osYmm = (xcr0 & 0x6) == 0x6;
+    const bool osZmm = (xcr0 & 0xe6) == 0xe6;
+
+    if (avx512f && osZmm)
+      return SimdIsa::AVX512;
+    if (avx && avx2 && fma && osYmm)
+      return SimdIsa::AVX2;
+    if (sse41)
+      return SimdIsa::SSE4;
+    return SimdIsa::Scalar;
+  }
+#endif
+}
+
+void HeavyCalculationScalar(const float* a, const float* b, float* c,
+  int iMin, int iMax, int numElements, int maxLoopIdx)
+{
+  for (int i = iMin; i < iMax; i++)
+  {
+    c[i] = 0.0f;
+    for (int ind = 0; ind < maxLoopIdx; ind++)
+    {
+      int k = (int)((4ll * i + ind) % numElements);
+      c[i] += sin(k * a[k]) * cos(k * b[k]);
+    }
+  }
+}
+
+SimdIsa detectSimdIsa()
+{
+#ifdef HEAVY_CALCULATION_X86
+  static const SimdIsa isa = queryCpu();
+  return isa;
+#else
+  return SimdIsa::Scalar;
+#endif
+}
+
+bool isSimdIsaSupported(SimdIsa isa)
+{
+  return (int)isa <= (int)detectSimdIsa();
+}
+
+const char* simdIsaName(SimdIsa isa)
+{
+  switch (isa)
+  {
+  case SimdIsa::SSE4: return "SSE4.1";
+  case SimdIsa::AVX2: return "AVX2";
+  case SimdIsa::AVX512: return "AVX-512";
+  default: return "Scalar";
+  }
+}
+
+int simdIsaLanes(SimdIsa isa)
+{
+  switch (isa)
+  {
+  case SimdIsa::SSE4: return 4;
+  case SimdIsa::AVX2: return 8;
+  case SimdIsa::AVX512: return 16;
+  default: return 1;
+  }
+}
+
+HeavyCalculationKernel getHeavyCalculationKernel(SimdIsa isa)
+{
+  if (!isSimdIsaSupported(isa))
+    return HeavyCalculationScalar;
+#ifdef HEAVY_CALCULATION_X86
+  switch (isa)
+  {
+  case SimdIsa::SSE4: return HeavyCalculationSse4;
+  case SimdIsa::AVX2: return HeavyCalculationAvx2;
+  case SimdIsa::AVX512: return HeavyCalculationAvx512;
+  default: break;
+  }
+#endif
+  return HeavyCalculationScalar;
+}
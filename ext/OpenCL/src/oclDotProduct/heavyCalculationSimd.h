@@ -0,0 +1,28 @@
+#pragma once
+
+// Host implementations of the HeavyCalculation inner loop
+//   c[i] = sum_{ind < maxLoopIdx} sin(k * a[k]) * cos(k * b[k]),  k = (4 * i + ind) % numElements
+// The scalar version is the reference, the SIMD versions evaluate sincos on 4/8/16 lanes.
+
+enum class SimdIsa
+{
+  Scalar,
+  SSE4,
+  AVX2,
+  AVX512
+};
+
+using HeavyCalculationKernel = void (*)(const float* a, const float* b, float* c,
+  int iMin, int iMax, int numElements, int maxLoopIdx);
+
+void HeavyCalculationScalar(const float* a, const float* b, float* c,
+  int iMin, int iMax, int numElements, int maxLoopIdx);
+
+// Best ISA supported by both the binary and the running CPU (CPUID + OS state)
+SimdIsa detectSimdIsa();
+bool isSimdIsaSupported(SimdIsa isa);
+const char* simdIsaName(SimdIsa isa);
+int simdIsaLanes(SimdIsa isa);
+
+// Kernel for the given ISA; falls back to the scalar one when it is not supported
+HeavyCalculationKernel getHeavyCalculationKernel(SimdIsa isa);
@@ -0,0 +1,83 @@
+// Width-generic body of the SIMD HeavyCalculation kernels.
+// Included by the per-ISA translation units inside their target region, after <immintrin.h>;
+// they instantiate it with an Ops struct wrapping the intrinsics of that ISA.
+// <math.h> must already be included before the target region, and std:: helpers are avoided here:
+// their instantiations would be compiled for the wider ISA and could leak into the scalar code.
+
+namespace
+{
+  // Cody-Waite split of pi/2: PIO2_HI has 33 significant bits, so q * PIO2_HI is exact for |q| < 2^20
+  const double TWO_OVER_PI = 6.36619772367581382433e-01;
+  const double PIO2_HI = 1.57079632673412561417e+00;
+  const double PIO2_LO = 6.07710050650619224932e-11;
+
+  // Minimax polynomials on [-pi/4, pi/4] (Cephes sinf/cosf)
+  template <class Ops>
+  typename Ops::vf sinPoly(typename Ops::vf r)
+  {
+    auto z = Ops::mul(r, r);
+    auto y = Ops::fmadd(Ops::set1(-1.9515295891e-4f), z, Ops::set1(8.3321608736e-3f));
+    y = Ops::fmadd(y, z, Ops::set1(-1.6666654611e-1f));
+    return Ops::fmadd(Ops::mul(y, z), r, r);
+  }
+
+  template <class Ops>
+  typename Ops::vf cosPoly(typename Ops::vf r)
+  {
+    auto z = Ops::mul(r, r);
+    auto y = Ops::fmadd(Ops::set1(2.443315711809948e-5f), z, Ops::set1(-1.388731625493765e-3f));
+    y = Ops::fmadd(y, z, Ops::set1(4.166664568298827e-2f));
+    y = Ops::mul(Ops::mul(y, z), z);
+    return Ops::add(Ops::fmadd(Ops::set1(-0.5f), z, y), Ops::set1(1.0f));
+  }
+
+  // sin(xa) * cos(xb) per lane, with x = r + q * pi/2 reduced in double precision
+  template <class Ops>
+  typename Ops::vf sinCosTerm(typename Ops::vf xa, typename Ops::vf xb)
+  {
+    typename Ops::vf ra, rb;
+    typename Ops::vi qa, qb;
+    Ops::reduce(xa, ra, qa);
+    Ops::reduce(xb, rb, qb);
+
+    // sin: quadrants 1, 3 use cos(r); quadrants 2, 3 are negative
+    auto sinA = Ops::negateIfBit1(Ops::selectOdd(qa, cosPoly<Ops>(ra), sinPoly<Ops>(ra)), qa);
+    // cos: quadrants 1, 3 use sin(r); quadrants 1, 2 are negative
+    auto cosB = Ops::negateIfBit1(Ops::selectOdd(qb, sinPoly<Ops>(rb), cosPoly<Ops>(rb)), Ops::addOne(qb));
+    return Ops::mul(sinA, cosB);
+  }
+
+  template <class Ops>
+  void heavyCalculationRange(const float* a, const float* b, float* c,
+    int iMin, int iMax, int numElements, int maxLoopIdx)
+  {
+    const int WIDTH = Ops::WIDTH;
+    for (int i = iMin; i < iMax; i++)
+    {
+      auto acc = Ops::set1(0.0f);
+      float tail = 0.0f;
+      int k = (int)((4ll * i) % numElements);
+      int remaining = maxLoopIdx;
+      // The window is contiguous except where it wraps around numElements
+      while (remaining > 0)
+      {
+        const int len = (remaining < numElements - k) ? remaining : numElements - k;
+        int j = 0;
+        for (; j + WIDTH <= len; j += WIDTH)
+        {
+          const int kk = k + j;
+          auto kf = Ops::ramp((float)kk);
+          acc = Ops::add(acc, sinCosTerm<Ops>(Ops::mul(kf, Ops::load(a + kk)), Ops::mul(kf, Ops::load(b + kk))));
+        }
+        for (; j < len; j++)
+        {
+          const int kk = k + j;
+          tail += sinf(kk * a[kk]) * cosf(kk * b[kk]);
+        }
+        remaining -= len;
+        k = 0;
+      }
+      c[i] = Ops::reduceAdd(acc) + tail;
+    }
+  }
+}
@@ -0,0 +1,83 @@
+// SSE4.1 HeavyCalculation kernel, 4 lanes.
+// SSE4.1 intrinsics need no extra switch on MSVC, GCC/Clang get the target through the pragma below.
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+
+#include <math.h>
+
+#if defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("sse4.1")
+#endif
+
+#include <immintrin.h>
+#include "heavyCalculationSimdImpl.h"
+
+namespace
+{
+  struct Sse4Ops
+  {
+    static const int WIDTH = 4;
+    using vf = __m128;
+    using vi = __m128i;
+
+    static vf load(const float* p) { return _mm_loadu_ps(p); }
+    static vf set1(float x) { return _mm_set1_ps(x); }
+    static vf add(vf x, vf y) { return _mm_add_ps(x, y); }
+    static vf mul(vf x, vf y) { return _mm_mul_ps(x, y); }
+    static vf fmadd(vf x, vf y, vf z) { return _mm_add_ps(_mm_mul_ps(x, y), z); }
+    static vf ramp(float base) { return _mm_add_ps(_mm_set1_ps(base), _mm_setr_ps(0, 1, 2, 3)); }
+    static vi addOne(vi q) { return _mm_add_epi32(q, _mm_set1_epi32(1)); }
+
+    static float reduceAdd(vf x)
+    {
+      __m128 sum = _mm_add_ps(x, _mm_movehl_ps(x, x));
+      sum = _mm_add_ss(sum, _mm_shuffle_ps(sum, sum, 1));
+      return _mm_cvtss_f32(sum);
+    }
+
+    // Reduces the two low lanes of x
+    static void reduceHalf(__m128 x, __m128& r, __m128i& q)
+    {
+      __m128d d = _mm_cvtps_pd(x);
+      __m128d qd = _mm_round_pd(_mm_mul_pd(d, _mm_set1_pd(TWO_OVER_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+      d = _mm_sub_pd(d, _mm_mul_pd(qd, _mm_set1_pd(PIO2_HI)));
+      d = _mm_sub_pd(d, _mm_mul_pd(qd, _mm_set1_pd(PIO2_LO)));
+      r = _mm_cvtpd_ps(d);
+      q = _mm_cvtpd_epi32(qd);
+    }
+
+    static void reduce(vf x, vf& r, vi& q)
+    {
+      __m128 rLo, rHi;
+      __m128i qLo, qHi;
+      reduceHalf(x, rLo, qLo);
+      reduceHalf(_mm_movehl_ps(x, x), rHi, qHi);
+      r = _mm_movelh_ps(rLo, rHi);
+      q = _mm_unpacklo_epi64(qLo, qHi);
+    }
+
+    static vf selectOdd(vi q, vf ifOdd, vf ifEven)
+    {
+      __m128i odd = _mm_slli_epi32(q, 31);
+      return _mm_blendv_ps(ifEven, ifOdd, _mm_castsi128_ps(odd));
+    }
+
+    static vf negateIfBit1(vf x, vi q)
+    {
+      __m128i sign = _mm_slli_epi32(_mm_and_si128(q, _mm_set1_epi32(2)), 30);
+      return _mm_xor_ps(x, _mm_castsi128_ps(sign));
+    }
+  };
+}
+
+void HeavyCalculationSse4(const float* a, const float* b, float* c,
+  int iMin, int iMax, int numElements, int maxLoopIdx)
+{
+  heavyCalculationRange<Sse4Ops>(a, b, c, iMin, iMax, numElements, maxLoopIdx);
+}
+
+#if defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+#endif
@@ -1,13 +1,260 @@
 const char * CL_PROGRAM_HEAVY_CALCULATION = R"( 
- __kernel void HeavyCalculation (__global float* a, __global float* b, __global float* c, int iNumElements)
+ __kernel void HeavyCalculation (__global float* a, __global float* b, __global float* c, int iNumElements, int maxLoopIdx)
 {
     int i = get_global_id(0);
 
-   for(int ind = 0; ind < 0; ind++)
+   float sum = 0.0f;
+   for(int ind = 0; ind < maxLoopIdx; ind++)
    {
      int k = (4 * i + ind) % iNumElements;
-     c[i] += sin(k * a[k]) * cos(k * b[k]);
+     sum += sin(k * a[k]) * cos(k * b[k]);
    }
+   c[i] = sum;
 
 }
+
+// Halo layout: a and b repeat their first maxLoopIdx elements behind element iNumElements,
+// so the window is read linearly and only the multiplier needs wrapping (requires maxLoopIdx <= iNumElements)
+ __kernel void HeavyCalculationHalo (__global float* a, __global float* b, __global float* c, int iNumElements, int maxLoopIdx)
+{
+    int i = get_global_id(0);
+    int start = (4 * i) % iNumElements;
+
+   float sum = 0.0f;
+   for(int ind = 0; ind < maxLoopIdx; ind++)
+   {
+     int k = start + ind;
+     float kWrapped = (float)(k < iNumElements ? k : k - iNumElements);
+     sum += sin(kWrapped * a[k]) * cos(kWrapped * b[k]);
+   }
+   c[i] = sum;
+
+}
+
+// float4 layout: every work item loads whole float4s and produces the four results c[4i .. 4i+3].
+// Result j sums the window starting at element 4j, i.e. at float4 j, so the windows of one work item
+// are one float4 apart and each float4 term is evaluated once for all four of them
+// (requires iNumElements % 4 == 0)
+float Vec4Terms (__global const float4* a, __global const float4* b, int v, float4 mask)
+{
+    float4 k = (float4)(4.0f * v) + (float4)(0.0f, 1.0f, 2.0f, 3.0f);
+    return dot(sin(k * a[v]) * cos(k * b[v]), mask);
+}
+
+ __kernel void HeavyCalculationVec4 (__global const float4* a, __global const float4* b, __global float4* c,
+    int iNumElements, int maxLoopIdx)
+{
+    int i = get_global_id(0);
+    int numVectors = iNumElements / 4;
+    int fullVectors = maxLoopIdx / 4;
+    int tail = maxLoopIdx % 4;
+
+   // Result l of this work item covers the float4 terms m in [l, l + fullVectors)
+   float4 sum = (float4)(0.0f);
+   for(int m = 0; fullVectors > 0 && m < fullVectors + 3; m++)
+   {
+     float t = Vec4Terms(a, b, (4 * i + m) % numVectors, (float4)(1.0f));
+     sum.x += m < fullVectors ? t : 0.0f;
+     sum.y += m >= 1 && m < fullVectors + 1 ? t : 0.0f;
+     sum.z += m >= 2 && m < fullVectors + 2 ? t : 0.0f;
+     sum.w += m >= 3 ? t : 0.0f;
+   }
+   // The first tail elements of the float4 right behind each window
+   if (tail > 0)
+   {
+     float4 mask = (float4)(1.0f, tail > 1 ? 1.0f : 0.0f, tail > 2 ? 1.0f : 0.0f, 0.0f);
+     int v = 4 * i + fullVectors;
+     sum.x += Vec4Terms(a, b, v % numVectors, mask);
+     sum.y += Vec4Terms(a, b, (v + 1) % numVectors, mask);
+     sum.z += Vec4Terms(a, b, (v + 2) % numVectors, mask);
+     sum.w += Vec4Terms(a, b, (v + 3) % numVectors, mask);
+   }
+   c[i] = sum;
+
+}
+
+// Streaming and tiles: a and b hold only the source window of one chunk, starting at element windowStart
+// (wrapped around iNumElements), and i is the result index within the chunk. With resident set they hold
+// the whole array instead, for tiles whose window would be longer than the array.
+ __kernel void HeavyCalculationChunk (__global const float* a, __global const float* b, __global float* c,
+    int iNumElements, int maxLoopIdx, int windowStart, int resident)
+{
+    int i = get_global_id(0);
+
+   float sum = 0.0f;
+   for(int ind = 0; ind < maxLoopIdx; ind++)
+   {
+     int j = 4 * i + ind;
+     int k = (windowStart + j) % iNumElements;
+     // A resident buffer holds the whole array in place, a window holds it from windowStart on
+     int w = resident ? k : j;
+     sum += sin(k * a[w]) * cos(k * b[w]);
+   }
+   c[i] = sum;
+
+}
+
+// ---------------------------------------------------------------------
+// Range-reduction prepass: k * a[k] and k * b[k] are reduced to [-pi, pi] once per element
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+float ReduceArgument (int k, float x)
+{
+    return (float)remainder((double)k * x, 6.28318530717958647692);
+}
+#else
+// No doubles: exact float-float product, then a three-term Cody-Waite reduction by 2*pi
+float ReduceArgument (int k, float x)
+{
+    float kf = (float)k;
+    float hi = kf * x;
+    float lo = fma(kf, x, -hi);
+    float q = rint(hi * 0.159154943091895335768f);
+    float r = fma(-q, 6.28318548202514648438f, hi);
+    r = fma(-q, -1.74845553146951604382e-7f, r);
+    r = fma(-q, 7.04463216938107787663e-15f, r);
+    return r + lo;
+}
+#endif
+
+__kernel void ReduceArguments (__global const float* a, __global const float* b,
+    __global float* reducedA, __global float* reducedB, int iNumElements)
+{
+    int k = get_global_id(0);
+    if (k >= iNumElements)
+        return;
+    reducedA[k] = ReduceArgument(k, a[k]);
+    reducedB[k] = ReduceArgument(k, b[k]);
+}
+
+// Direct summation over the reduced arguments; the small range lets the native sin/cos be used
+ __kernel void HeavyCalculationReduced (__global const float* reducedA, __global const float* reducedB, __global float* c,
+    int iNumElements, int maxLoopIdx)
+{
+    int i = get_global_id(0);
+    int k = (4 * i) % iNumElements;
+
+   float sum = 0.0f;
+   for(int ind = 0; ind < maxLoopIdx; ind++)
+   {
+     sum += native_sin(reducedA[k]) * native_cos(reducedB[k]);
+     if (++k == iNumElements)
+       k = 0;
+   }
+   c[i] = sum;
+
+}
+
+// ---------------------------------------------------------------------
+// Prefix-sum mode: every term is evaluated once, c[i] is a wrap-around window sum over the scanned terms.
+// c[i] is the difference of two prefixes over up to iNumElements terms, so the scan runs in double where
+// the device has it and in compensated float-float (value, error) otherwise; both are 8 bytes per element.
+
+#ifdef cl_khr_fp64
+#pragma OPENCL EXTENSION cl_khr_fp64 : enable
+typedef double prefix_t;
+
+prefix_t PrefixFromFloat (float x) { return (double)x; }
+prefix_t PrefixAdd (prefix_t x, prefix_t y) { return x + y; }
+prefix_t PrefixSub (prefix_t x, prefix_t y) { return x - y; }
+prefix_t PrefixScale (prefix_t x, int n) { return x * n; }
+float PrefixToFloat (prefix_t x) { return (float)x; }
+#else
+typedef float2 prefix_t;
+
+prefix_t PrefixFromFloat (float x) { return (float2)(x, 0.0f); }
+// Knuth's two-sum of the values, the rounding error joins the error terms
+prefix_t PrefixAdd (prefix_t x, prefix_t y)
+{
+    float s = x.x + y.x;
+    float v = s - x.x;
+    float e = (x.x - (s - v)) + (y.x - v) + x.y + y.y;
+    float hi = s + e;
+    return (float2)(hi, e - (hi - s));
+}
+prefix_t PrefixSub (prefix_t x, prefix_t y) { return PrefixAdd(x, -y); }
+prefix_t PrefixScale (prefix_t x, int n) { return PrefixAdd((float2)(x.x * n, 0.0f), (float2)(fma(x.x, (float)n, -x.x * n), x.y * n)); }
+float PrefixToFloat (prefix_t x) { return x.x + x.y; }
+#endif
+
+__kernel void HeavyTerms (__global const float* a, __global const float* b, __global prefix_t* terms, int iNumElements)
+{
+    int k = get_global_id(0);
+    terms[k] = PrefixFromFloat((k < iNumElements) ? sin(k * a[k]) * cos(k * b[k]) : 0.0f);
+}
+
+// Inclusive Hillis-Steele scan of one work-group sized block, block totals go to blockSums
+__kernel void ScanBlocks (__global prefix_t* values, __global prefix_t* blockSums, __local prefix_t* tmp)
+{
+    int gid = get_global_id(0);
+    int lid = get_local_id(0);
+    int n = get_local_size(0);
+
+    tmp[lid] = values[gid];
+    barrier(CLK_LOCAL_MEM_FENCE);
+    for (int offset = 1; offset < n; offset <<= 1)
+    {
+        prefix_t x = (lid >= offset) ? tmp[lid - offset] : PrefixFromFloat(0.0f);
+        barrier(CLK_LOCAL_MEM_FENCE);
+        tmp[lid] = PrefixAdd(tmp[lid], x);
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+    values[gid] = tmp[lid];
+    if (lid == n - 1)
+        blockSums[get_group_id(0)] = tmp[lid];
+}
+
+// Exclusive scan of the block totals in place, run as a single work-group
+__kernel void ScanBlockSums (__global prefix_t* blockSums, int numBlocks, __local prefix_t* tmp)
+{
+    int lid = get_local_id(0);
+    int n = get_local_size(0);
+    prefix_t carry = PrefixFromFloat(0.0f);
+
+    for (int base = 0; base < numBlocks; base += n)
+    {
+        int idx = base + lid;
+        prefix_t value = (idx < numBlocks) ? blockSums[idx] : PrefixFromFloat(0.0f);
+        tmp[lid] = value;
+        barrier(CLK_LOCAL_MEM_FENCE);
+        for (int offset = 1; offset < n; offset <<= 1)
+        {
+            prefix_t x = (lid >= offset) ? tmp[lid - offset] : PrefixFromFloat(0.0f);
+            barrier(CLK_LOCAL_MEM_FENCE);
+            tmp[lid] = PrefixAdd(tmp[lid], x);
+            barrier(CLK_LOCAL_MEM_FENCE);
+        }
+        if (idx < numBlocks)
+            blockSums[idx] = PrefixAdd(carry, PrefixSub(tmp[lid], value));
+        carry = PrefixAdd(carry, tmp[n - 1]);
+        barrier(CLK_LOCAL_MEM_FENCE);
+    }
+}
+
+// Sum of terms[0..k)
+prefix_t PrefixBefore (__global const prefix_t* scan, __global const prefix_t* blockOffsets, int k, int blockSize)
+{
+    return (k == 0) ? PrefixFromFloat(0.0f) : PrefixAdd(scan[k - 1], blockOffsets[(k - 1) / blockSize]);
+}
+
+__kernel void WindowSum (__global const prefix_t* scan, __global const prefix_t* blockOffsets, __global float* c,
+    int iNumElements, int maxLoopIdx, int blockSize)
+{
+    int i = get_global_id(0);
+    if (i >= iNumElements)
+        return;
+
+    prefix_t total = PrefixBefore(scan, blockOffsets, iNumElements, blockSize);
+    int start = (4 * i) % iNumElements;
+    int rest = maxLoopIdx % iNumElements;
+    prefix_t startPrefix = PrefixBefore(scan, blockOffsets, start, blockSize);
+
+    prefix_t sum = PrefixScale(total, maxLoopIdx / iNumElements);
+    if (start + rest <= iNumElements)
+        sum = PrefixAdd(sum, PrefixSub(PrefixBefore(scan, blockOffsets, start + rest, blockSize), startPrefix));
+    else
+        sum = PrefixAdd(sum, PrefixAdd(PrefixSub(total, startPrefix), PrefixBefore(scan, blockOffsets, start + rest - iNumElements, blockSize)));
+    c[i] = PrefixToFloat(sum);
+}
 )";
\ No newline at end of file
@@ -1,3 +1,4 @@
+#include <algorithm>
 #include <string>
 #include <iostream>
 #include <vector>
@@ -7,10 +8,22 @@
 #include <shrQATest.h>
 
 #include "heavyCalculator.h"
+#include "eventProfiler.h"
+#include "heavyCalculationSimd.h"
+#include "perfCounters.h"
+#include "hostMemory.h"
+#include "programCache.h"
+#include "rangeReduction.h"
+#include "roofline.h"
+#include "threadPool.h"
 #include "timer.h"
+#include "traceExporter.h"
+#include "workGroupTuner.h"
 
 #include "heavyCalculator.cl"
 #include <future>
+#include <iomanip>
+#include <random>
 
 size_t szParmDataBytes;			// Byte size of context information
 
@@ -21,19 +34,27 @@ namespace
   const size_t NUM_ELEMENTS = size_t(1.e6);
   const size_t MAX_LOOP_IDX = size_t(0);
   const size_t LOCAL_WORK_SIZE = 256;
+  // Queues and buffer sets of the streaming mode: upload, compute and read-back of three chunks overlap
+  const size_t STREAM_COUNT = 3;
+  // Buffer sets of the tiled mode: a tile copies the overlap of its window from the previous tile's set
+  const size_t TILE_BUFFER_SETS = 2;
+  // Share of the global memory the buffers may take, the rest is left to the driver and the program
+  const double DEVICE_MEMORY_SHARE = 0.75;
+  // Floating-point ops of one HeavyCalculation term: two scalings, sin, cos, product and sum
+  // (sin and cos count as one op each, as the native instructions do)
+  const double FLOPS_PER_TERM = 6.0;
 
+  // Dispatched once from CPUID to the widest supported SIMD kernel
   void HeavyCalculationCPU(const float* a, const float* b, float* c, int iMin, int iMax)
   {
-    for (int i = iMin; i < iMax; i++)
-    {
-      c[i] = 0.0f;
-      for (int ind = 0; ind < MAX_LOOP_IDX; ind++)
-      {
-        int k = (4 * i + ind) % NUM_ELEMENTS;
-        c[i] += sin(k * a[k]) * cos(k * b[k]);
-      }
-
-    }
+    static const auto kernel = getHeavyCalculationKernel(detectSimdIsa());
+    PerfScope perf("HeavyCalculation");
+    const bool traced = TraceExporter::instance().enabled();
+    const int64_t begin = traced ? Timer::now() : 0;
+    kernel(a, b, c, iMin, iMax, (int)NUM_ELEMENTS, (int)MAX_LOOP_IDX);
+    if (traced)
+      TraceExporter::instance().addHostSpan("HeavyCalculationCPU [" + std::to_string(iMin) + ", " + std::to_string(iMax) + ")",
+        "host chunk", begin, Timer::now());
   }
 
   template <class T>
@@ -58,7 +79,8 @@ namespace
     return result;
   
   }
-  void HeavyCalculation(const float* pfData1, const float* pfData2, float* pfResult, int iNumElements)
+  // Legacy fan-out: one fresh std::async thread per level, kept as the benchmark baseline
+  void HeavyCalculationAsync(const float* pfData1, const float* pfData2, float* pfResult, int iNumElements)
   {
     auto levels = getLevels(iNumElements, NUM_THREADS);
     std::vector<std::future<void>> futures;
@@ -72,8 +94,271 @@ namespace
     {
       f.get();
     }
-    int x = 5; x;
+  }
+
+  void HeavyCalculationRange(const float* pfData1, const float* pfData2, float* pfResult, size_t iBegin, size_t iEnd)
+  {
+    ThreadPool::instance().parallelFor(iBegin, iEnd, [=](size_t iMin, size_t iMax)
+    {
+      HeavyCalculationCPU(pfData1, pfData2, pfResult, (int)iMin, (int)iMax);
+    });
+  }
 
+  void HeavyCalculation(const float* pfData1, const float* pfData2, float* pfResult, int iNumElements)
+  {
+    HeavyCalculationRange(pfData1, pfData2, pfResult, 0, iNumElements);
+  }
+
+  // Parallel replacement of shrFillArray: every chunk gets its own generator seeded by the chunk start,
+  // so the content does not depend on which worker picks the chunk up
+  void fillArray(float* pfData, size_t size)
+  {
+    ThreadPool::instance().parallelFor(0, size, [pfData](size_t iMin, size_t iMax)
+    {
+      PerfScope perf("fillArray");
+      std::minstd_rand generator((unsigned int)iMin + 1);
+      const float scale = 1.0f / (float)generator.max();
+      for (size_t i = iMin; i < iMax; ++i)
+      {
+        pfData[i] = scale * generator();
+      }
+    });
+  }
+
+  // Sum of the maxLoopIdx terms starting at start, wrapping around numElements;
+  // prefix[k] holds the sum of the first k terms
+  double windowSum(const std::vector<double>& prefix, size_t start, size_t maxLoopIdx, size_t numElements)
+  {
+    const double total = prefix[numElements];
+    const size_t rest = maxLoopIdx % numElements;
+    double sum = (double)(maxLoopIdx / numElements) * total;
+    if (start + rest <= numElements)
+      sum += prefix[start + rest] - prefix[start];
+    else
+      sum += total - prefix[start] + prefix[start + rest - numElements];
+    return sum;
+  }
+
+  // O(N) alternative to HeavyCalculation: every term is evaluated once and c[i] is read off a prefix sum
+  void HeavyCalculationPrefixSum(const float* a, const float* b, float* c, size_t numElements, size_t maxLoopIdx)
+  {
+    auto& pool = ThreadPool::instance();
+    // Double precision, so that the difference of two large prefixes keeps float accuracy
+    std::vector<double> prefix(numElements + 1, 0.0);
+    pool.parallelFor(0, numElements, [&](size_t kMin, size_t kMax)
+    {
+      for (size_t k = kMin; k < kMax; k++)
+      {
+        const int kk = (int)k;
+        prefix[k + 1] = sin(kk * a[k]) * cos(kk * b[k]);
+      }
+    });
+
+    // Two-pass parallel scan: chunk totals, exclusive scan of the totals, then local scans with offsets
+    const size_t numChunks = std::min(numElements, 4 * pool.size());
+    std::vector<double> chunkOffsets(numChunks + 1, 0.0);
+    auto chunkBegin = [&](size_t chunk) { return 1 + numElements * chunk / numChunks; };
+    pool.parallelFor(0, numChunks, [&](size_t chunkMin, size_t chunkMax)
+    {
+      for (size_t chunk = chunkMin; chunk < chunkMax; chunk++)
+      {
+        double sum = 0.0;
+        for (size_t k = chunkBegin(chunk); k < chunkBegin(chunk + 1); k++)
+          sum += prefix[k];
+        chunkOffsets[chunk + 1] = sum;
+      }
+    }, numChunks);
+    for (size_t chunk = 0; chunk < numChunks; chunk++)
+    {
+      chunkOffsets[chunk + 1] += chunkOffsets[chunk];
+    }
+    pool.parallelFor(0, numChunks, [&](size_t chunkMin, size_t chunkMax)
+    {
+      for (size_t chunk = chunkMin; chunk < chunkMax; chunk++)
+      {
+        double running = chunkOffsets[chunk];
+        for (size_t k = chunkBegin(chunk); k < chunkBegin(chunk + 1); k++)
+        {
+          running += prefix[k];
+          prefix[k] = running;
+        }
+      }
+    }, numChunks);
+
+    pool.parallelFor(0, numElements, [&](size_t iMin, size_t iMax)
+    {
+      for (size_t i = iMin; i < iMax; i++)
+      {
+        c[i] = (float)windowSum(prefix, (4 * i) % numElements, maxLoopIdx, numElements);
+      }
+    });
+  }
+
+  void reportAccuracy(const float* reference, const float* data, size_t size)
+  {
+    double maxAbsError = 0.0;
+    double maxRelError = 0.0;
+    double sumSquaredError = 0.0;
+    for (size_t i = 0; i < size; i++)
+    {
+      const double error = fabs((double)data[i] - (double)reference[i]);
+      maxAbsError = std::max(maxAbsError, error);
+      if (reference[i] != 0.0f)
+        maxRelError = std::max(maxRelError, error / fabs((double)reference[i]));
+      sumSquaredError += error * error;
+    }
+    std::cout << "  max abs error = " << maxAbsError << ", max rel error = " << maxRelError
+      << ", rms error = " << sqrt(sumSquaredError / std::max<size_t>(size, 1)) << std::endl;
+  }
+
+  // Pass/fail comparison within shrComparefet's minimum tolerance, |reference - data| <= 1e-3, in chunks on the pool.
+  // A chunk stops at its first mismatch, and the others stop at their next block once one has failed.
+  bool compareResults(const float* reference, const float* data, size_t size)
+  {
+    shrCompareStop stop(0);
+    std::atomic<size_t> errorCount{ 0 };
+    ThreadPool::instance().parallelFor(0, size, [&](size_t iMin, size_t iMax)
+    {
+      PerfScope perf("compareDataAsFloatThreshold");
+      errorCount += shrComparefRange(reference + iMin, data + iMin, (unsigned int)(iMax - iMin), 1.e-3f, SHR_COMPARE_ABSOLUTE, &stop);
+    });
+    if (errorCount == 0)
+      return true;
+    std::cout << "  mismatch: at least " << errorCount << " of " << size << " results off by more than 1e-3" << std::endl;
+    return false;
+  }
+
+  void benchmarkThreadPool(const float* pfData1, const float* pfData2, size_t numElements)
+  {
+    const int NUM_REPETITIONS = 100;
+    std::vector<cl_float> results(numElements);
+    std::cout << "Benchmarking host scheduling over " << NUM_REPETITIONS << " repetitions..." << std::endl;
+
+    auto measure = [&](void (*calculation)(const float*, const float*, float*, int))
+    {
+      calculation(pfData1, pfData2, results.data(), (int)numElements); // warmup
+      auto begin = std::chrono::steady_clock::now();
+      for (int rep = 0; rep < NUM_REPETITIONS; ++rep)
+      {
+        calculation(pfData1, pfData2, results.data(), (int)numElements);
+      }
+      auto end = std::chrono::steady_clock::now();
+      return std::chrono::duration<double, std::micro>(end - begin).count() / NUM_REPETITIONS;
+    };
+
+    const double asyncUs = measure(HeavyCalculationAsync);
+    const double poolUs = measure(HeavyCalculation);
+    std::cout << "  std::async fan-out (" << NUM_THREADS << " threads): " << asyncUs << " us/run" << std::endl;
+    std::cout << "  work-stealing pool (" << ThreadPool::instance().size() << " workers): " << poolUs << " us/run" << std::endl;
+    std::cout << "  speedup: " << asyncUs / poolUs << "x" << std::endl;
+  }
+
+  // Single-threaded throughput and accuracy of every ISA level against the scalar reference
+  void reportSimdThroughput(const float* a, const float* b, size_t numElements)
+  {
+    const int LOOP_IDX = 64;
+    const int NUM_OUTPUTS = 1 << 14;
+    const int NUM_REPETITIONS = 5;
+    std::vector<cl_float> reference(NUM_OUTPUTS);
+    std::vector<cl_float> results(NUM_OUTPUTS);
+
+    std::cout << "SIMD throughput, " << NUM_OUTPUTS << " outputs x " << LOOP_IDX << " terms, one thread" << std::endl;
+    std::cout << "  detected: " << simdIsaName(detectSimdIsa()) << std::endl;
+    std::cout << "  " << std::left << std::setw(10) << "ISA" << std::setw(7) << "lanes" << std::setw(12) << "ms/run"
+      << std::setw(14) << "Mterms/s" << std::setw(10) << "speedup" << "max abs err" << std::right << std::endl;
+
+    double scalarMs = 0.0;
+    for (auto isa : { SimdIsa::Scalar, SimdIsa::SSE4, SimdIsa::AVX2, SimdIsa::AVX512 })
+    {
+      if (!isSimdIsaSupported(isa))
+      {
+        std::cout << "  " << std::left << std::setw(10) << simdIsaName(isa) << "not supported on this CPU" << std::right << std::endl;
+        continue;
+      }
+      auto kernel = getHeavyCalculationKernel(isa);
+      auto& output = (isa == SimdIsa::Scalar) ? reference : results;
+      kernel(a, b, output.data(), 0, NUM_OUTPUTS, (int)numElements, LOOP_IDX); // warmup
+      auto begin = std::chrono::steady_clock::now();
+      for (int rep = 0; rep < NUM_REPETITIONS; ++rep)
+      {
+        kernel(a, b, output.data(), 0, NUM_OUTPUTS, (int)numElements, LOOP_IDX);
+      }
+      auto end = std::chrono::steady_clock::now();
+      const double ms = std::chrono::duration<double, std::milli>(end - begin).count() / NUM_REPETITIONS;
+      if (isa == SimdIsa::Scalar)
+        scalarMs = ms;
+
+      double maxError = 0.0;
+      for (int i = 0; i < NUM_OUTPUTS; ++i)
+      {
+        maxError = std::max(maxError, (double)fabs(output[i] - reference[i]));
+      }
+      std::cout << "  " << std::left << std::setw(10) << simdIsaName(isa) << std::setw(7) << simdIsaLanes(isa)
+        << std::setw(12) << ms << std::setw(14) << (double)NUM_OUTPUTS * LOOP_IDX / ms * 1.e-3
+        << std::setw(10) << scalarMs / ms << maxError << std::right << std::endl;
+    }
+  }
+
+  void reportPrefixSumBenchmark(const float* a, const float* b, size_t numElements)
+  {
+    std::vector<cl_float> direct(numElements);
+    std::vector<cl_float> prefixSum(numElements);
+    auto kernel = getHeavyCalculationKernel(detectSimdIsa());
+    std::cout << "Prefix-sum vs direct summation, " << numElements << " elements" << std::endl;
+    for (size_t maxLoopIdx : { size_t(16), size_t(64), size_t(256), size_t(1024) })
+    {
+      auto begin = std::chrono::steady_clock::now();
+      ThreadPool::instance().parallelFor(0, numElements, [&](size_t iMin, size_t iMax)
+      {
+        kernel(a, b, direct.data(), (int)iMin, (int)iMax, (int)numElements, (int)maxLoopIdx);
+      });
+      auto middle = std::chrono::steady_clock::now();
+      HeavyCalculationPrefixSum(a, b, prefixSum.data(), numElements, maxLoopIdx);
+      auto end = std::chrono::steady_clock::now();
+
+      const double directMs = std::chrono::duration<double, std::milli>(middle - begin).count();
+      const double prefixMs = std::chrono::duration<double, std::milli>(end - middle).count();
+      std::cout << "MAX_LOOP_IDX = " << maxLoopIdx << ": direct " << directMs << " ms, prefix-sum " << prefixMs
+        << " ms, speedup " << directMs / prefixMs << "x" << std::endl;
+      reportAccuracy(direct.data(), prefixSum.data(), numElements);
+    }
+  }
+
+  // Host direct path against the prepass + small-range sincos path, both measured against double precision
+  void reportRangeReductionBenchmark(const float* a, const float* b, size_t numElements)
+  {
+    const int LOOP_IDX = 64;
+    const int NUM_OUTPUTS = 1 << 14;
+    const int iNumElements = (int)numElements;
+    std::vector<double> reference(NUM_OUTPUTS);
+    std::vector<cl_float> direct(NUM_OUTPUTS);
+    std::vector<cl_float> reduced(NUM_OUTPUTS);
+    std::vector<cl_float> reducedA(numElements);
+    std::vector<cl_float> reducedB(numElements);
+
+    HeavyCalculationDoubleReference(a, b, reference.data(), 0, NUM_OUTPUTS, iNumElements, LOOP_IDX);
+
+    auto begin = std::chrono::steady_clock::now();
+    HeavyCalculationScalar(a, b, direct.data(), 0, NUM_OUTPUTS, iNumElements, LOOP_IDX);
+    auto directEnd = std::chrono::steady_clock::now();
+    reduceArguments(a, b, reducedA.data(), reducedB.data(), 0, iNumElements);
+    auto prepassEnd = std::chrono::steady_clock::now();
+    HeavyCalculationReducedScalar(reducedA.data(), reducedB.data(), reduced.data(), 0, NUM_OUTPUTS, iNumElements, LOOP_IDX);
+    auto end = std::chrono::steady_clock::now();
+
+    auto maxError = [&](const std::vector<cl_float>& values)
+    {
+      double error = 0.0;
+      for (int i = 0; i < NUM_OUTPUTS; i++)
+        error = std::max(error, fabs(values[i] - reference[i]));
+      return error;
+    };
+    auto ms = [](std::chrono::steady_clock::duration d) { return std::chrono::duration<double, std::milli>(d).count(); };
+
+    std::cout << "Range reduction, " << NUM_OUTPUTS << " outputs x " << LOOP_IDX << " terms, one thread" << std::endl;
+    std::cout << "  direct:  " << ms(directEnd - begin) << " ms, max abs error vs double = " << maxError(direct) << std::endl;
+    std::cout << "  reduced: " << ms(end - prepassEnd) << " ms + prepass " << ms(prepassEnd - directEnd)
+      << " ms over " << numElements << " elements, max abs error vs double = " << maxError(reduced) << std::endl;
   }
 
   cl_device_id getTargetDevice()
@@ -97,11 +382,94 @@ namespace
     return devices[TARGET_DEVICE];
   }
 
+  // Every device on the platform, GPUs and CPUs alike
+  std::vector<cl_device_id> getAllDevices()
+  {
+    cl_platform_id platformId;
+    oclGetPlatformID(&platformId);
+    cl_uint numDevices = 0;
+    clGetDeviceIDs(platformId, CL_DEVICE_TYPE_ALL, 0, nullptr, &numDevices);
+    std::vector<cl_device_id> devices(numDevices);
+    if (numDevices > 0)
+      clGetDeviceIDs(platformId, CL_DEVICE_TYPE_ALL, numDevices, devices.data(), nullptr);
+    std::cout << "# of Devices Available = " << numDevices << std::endl;
+    for (cl_uint i = 0; i < numDevices; ++i)
+    {
+      std::cout << "  Device " << i << ": ";
+      oclPrintDevName(LOGBOTH, devices[i]);
+      std::cout << std::endl;
+    }
+    return devices;
+  }
+
   void reportDeviceInfo(const cl_device_id targetDevice)
   {
     reportConstant<cl_uint>(targetDevice, CL_DEVICE_MAX_COMPUTE_UNITS, "Number of compute units = ");
     reportConstant<size_t>(targetDevice, CL_DEVICE_MAX_WORK_GROUP_SIZE, "Max Number work groups = ");
     reportConstant<size_t>(targetDevice, CL_KERNEL_WORK_GROUP_SIZE, "Max Number kernel work groups = ");
+    const auto peaks = theoreticalPeaks(targetDevice);
+    std::cout << "Clock = " << peaks.clockMHz << " MHz, cores = " << peaks.cores << (peaks.coresFromSmVersion ? "" : " (estimated)")
+      << ", peak = " << peaks.gflops << " GFLOP/s" << std::endl;
+  }
+
+  struct DeviceMemoryLimits
+  {
+    cl_ulong maxAlloc = 0;
+    cl_ulong budget = 0;
+  };
+
+  DeviceMemoryLimits getDeviceMemoryLimits(cl_device_id targetDevice)
+  {
+    cl_ulong globalMem = 0;
+    DeviceMemoryLimits limits;
+    clGetDeviceInfo(targetDevice, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(limits.maxAlloc), &limits.maxAlloc, nullptr);
+    clGetDeviceInfo(targetDevice, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMem), &globalMem, nullptr);
+    limits.budget = (cl_ulong)(DEVICE_MEMORY_SHARE * globalMem);
+    return limits;
+  }
+
+  // Two source buffers and a result buffer, in floats, against the per-allocation and total limits
+  bool fitsDeviceMemory(const DeviceMemoryLimits& limits, size_t sourceFloats, size_t resultFloats, size_t bufferSets = 1)
+  {
+    const cl_ulong sourceBytes = sizeof(cl_float) * (cl_ulong)sourceFloats;
+    const cl_ulong resultBytes = sizeof(cl_float) * (cl_ulong)resultFloats;
+    return sourceBytes <= limits.maxAlloc && resultBytes <= limits.maxAlloc &&
+      bufferSets * (2 * sourceBytes + resultBytes) <= limits.budget;
+  }
+
+  // Source floats the results [begin, begin + tileWorkSize) read, starting at 4 * begin. A window that would
+  // reach numElements wraps onto itself, so it is capped there: the tiles then share one resident copy.
+  size_t tileWindowSize(size_t tileWorkSize, size_t maxLoopIdx, size_t numElements)
+  {
+    return maxLoopIdx > 0 ? std::min(4 * (tileWorkSize - 1) + maxLoopIdx, numElements) : 0;
+  }
+
+  // TILE_BUFFER_SETS result buffers, with source windows per set or a resident copy of the sources they share
+  bool fitsTileBuffers(const DeviceMemoryLimits& limits, size_t windowSize, size_t tileWorkSize, size_t numElements)
+  {
+    const cl_ulong sourceBytes = sizeof(cl_float) * (cl_ulong)std::max<size_t>(windowSize, 4);
+    const cl_ulong resultBytes = sizeof(cl_float) * (cl_ulong)tileWorkSize;
+    const size_t sourceSets = windowSize < numElements ? TILE_BUFFER_SETS : 1;
+    return sourceBytes <= limits.maxAlloc && resultBytes <= limits.maxAlloc &&
+      sourceSets * 2 * sourceBytes + TILE_BUFFER_SETS * resultBytes <= limits.budget;
+  }
+
+  // Largest multiple of localWorkSize, at most globalWorkSize, whose tile buffers fit; 0 if none does
+  size_t selectTileWorkSize(const DeviceMemoryLimits& limits, size_t globalWorkSize, size_t localWorkSize, size_t maxLoopIdx,
+    size_t numElements)
+  {
+    size_t low = 0;
+    size_t high = globalWorkSize / localWorkSize;
+    while (low < high)
+    {
+      const size_t mid = (low + high + 1) / 2;
+      const size_t tileWorkSize = mid * localWorkSize;
+      if (fitsTileBuffers(limits, tileWindowSize(tileWorkSize, maxLoopIdx, numElements), tileWorkSize, numElements))
+        low = mid;
+      else
+        high = mid - 1;
+    }
+    return low * localWorkSize;
   }
 
   void reportComputationConstants(size_t numElements, size_t globalWorkSize, size_t localWorkSize)
@@ -114,37 +482,79 @@ namespace
 
   struct Data
   {
-    Data(size_t size) : 
-      sourceA(size),
-      sourceB(size),
-      heavyCalculationResults(size)
+    // haloSize > 0 selects the halo layout: the first haloSize floats of each source array are
+    // repeated right behind its numElements used floats, so a wrapping window reads linearly
+    // allocate = false leaves the arrays to be attached to mapped buffers
+    Data(size_t size, size_t numElements = 0, size_t haloSize = 0, bool allocate = true) :
+      sourceA(std::max(size, (numElements + haloSize + 3) / 4), allocate),
+      sourceB(std::max(size, (numElements + haloSize + 3) / 4), allocate),
+      heavyCalculationResults(size, allocate),
+      numElements(numElements),
+      haloSize(haloSize)
     {}
-    std::vector<cl_float4> sourceA;
-    std::vector<cl_float4> sourceB;
-    std::vector<cl_float> heavyCalculationResults;
+
+    void updateHalo()
+    {
+      for (auto source : { (float*)sourceA.data(), (float*)sourceB.data() })
+      {
+        std::copy(source, source + haloSize, source + numElements);
+      }
+    }
+
+    HostArray<cl_float4> sourceA;
+    HostArray<cl_float4> sourceB;
+    HostArray<cl_float> heavyCalculationResults;
+    size_t numElements;
+    size_t haloSize;
   };
 
-  cl_context createGPUContext(cl_device_id targetDevice)
+  // With tracing on, the device clock is aligned to the host once, before any command of the run
+  void alignTraceClock(cl_context gpuContext, cl_device_id device)
   {
-    auto timer = Timer("Creating GPU context");
+    if (!TraceExporter::instance().enabled())
+      return;
+    auto timer = Timer("Align trace clock");
+    TraceExporter::instance().calibrate(gpuContext, device);
+  }
 
-    return clCreateContext(nullptr, 1, &targetDevice, nullptr, nullptr, nullptr);
+  cl_context createGPUContext(cl_device_id targetDevice)
+  {
+    cl_context gpuContext = 0;
+    {
+      auto timer = Timer("Creating GPU context");
+      gpuContext = clCreateContext(nullptr, 1, &targetDevice, nullptr, nullptr, nullptr);
+    }
+    alignTraceClock(gpuContext, targetDevice);
+    return gpuContext;
   }
 
   void populateDataInput(Data& data, size_t numElements)
   {
     // Allocate and initialize host arrays
     shrLog("Allocate and Init Host Mem...\n");
-    shrFillArray((float*)data.sourceA.data(), int (4 * numElements));
-    shrFillArray((float*)data.sourceB.data(), int (4 * numElements));
+    fillArray((float*)data.sourceA.data(), 4 * numElements);
+    fillArray((float*)data.sourceB.data(), 4 * numElements);
+    data.updateHalo();
     shrLog("Allocation done and Init Host Mem...\n");
 
   }
 
-  bool buildProgram(cl_context gpuContext, cl_device_id targetDevice, cl_program &gpuProgram)
+  bool buildProgram(cl_context gpuContext, cl_device_id targetDevice, bool useCache, cl_program &gpuProgram)
   {
     auto timer = Timer("Build program");
 
+    if (useCache)
+    {
+      auto feedback = buildProgramCached(gpuContext, targetDevice, CL_PROGRAM_HEAVY_CALCULATION, nullptr,
+        programCacheDirectory(), gpuProgram);
+      if (feedback != CL_SUCCESS)
+      {
+        oclLogBuildInfo(gpuProgram, targetDevice);
+        return false;
+      }
+      return true;
+    }
+
     std::cout << "Creating program" << std::endl;
     size_t programSize = strlen(CL_PROGRAM_HEAVY_CALCULATION);			// Byte size of kernel code
     gpuProgram = clCreateProgramWithSource(gpuContext, 1, &CL_PROGRAM_HEAVY_CALCULATION, &programSize, nullptr);
@@ -160,70 +570,616 @@ namespace
     return true;
   }
 
-  HeavyCalculator::Buffers createBuffers(cl_context gpuContext, size_t globalWorkSize)
+  // sourceSize is in cl_float4 and includes the halo, if any
+  HeavyCalculator::Buffers createBuffers(cl_context gpuContext, size_t globalWorkSize, size_t sourceSize)
   {
     auto timer = Timer("Create buffers");
 
     HeavyCalculator::Buffers buffers;
-    buffers.sourceABuffer = clCreateBuffer(gpuContext, CL_MEM_READ_ONLY, sizeof(cl_float4) * globalWorkSize, nullptr, nullptr);
-    buffers.sourceBBuffer = clCreateBuffer(gpuContext, CL_MEM_READ_ONLY, sizeof(cl_float4) * globalWorkSize, nullptr, nullptr);
+    buffers.sourceABuffer = clCreateBuffer(gpuContext, CL_MEM_READ_ONLY, sizeof(cl_float4) * sourceSize, nullptr, nullptr);
+    buffers.sourceBBuffer = clCreateBuffer(gpuContext, CL_MEM_READ_ONLY, sizeof(cl_float4) * sourceSize, nullptr, nullptr);
     buffers.dstBuffer = clCreateBuffer(gpuContext, CL_MEM_WRITE_ONLY, sizeof(cl_float) * globalWorkSize, nullptr, nullptr);
 
     return buffers;
   }
 
-  cl_kernel createKernel(cl_program gpuProgram, HeavyCalculator::Buffers buffers, size_t numElements)
+  // The device scan runs in double or in float-float (heavyCalculator.cl, prefix_t), 8 bytes per element either way
+  const size_t PREFIX_BYTES = sizeof(cl_double);
+
+  void createPrefixSumBuffers(cl_context gpuContext, size_t globalWorkSize, size_t localWorkSize, HeavyCalculator::Buffers& buffers)
+  {
+    auto timer = Timer("Create prefix-sum buffers");
+
+    buffers.termsBuffer = clCreateBuffer(gpuContext, CL_MEM_READ_WRITE, PREFIX_BYTES * globalWorkSize, nullptr, nullptr);
+    buffers.blockSumsBuffer = clCreateBuffer(gpuContext, CL_MEM_READ_WRITE, PREFIX_BYTES * (globalWorkSize / localWorkSize), nullptr, nullptr);
+  }
+
+  HeavyCalculator::PrefixSumKernels createPrefixSumKernels(cl_program gpuProgram, HeavyCalculator::Buffers buffers,
+    size_t numElements, size_t maxLoopIdx, size_t globalWorkSize, size_t localWorkSize)
+  {
+    auto timer = Timer("Create prefix-sum kernels");
+
+    cl_int iNumElements = (cl_int)numElements;
+    cl_int iMaxLoopIdx = (cl_int)maxLoopIdx;
+    cl_int numBlocks = (cl_int)(globalWorkSize / localWorkSize);
+    cl_int blockSize = (cl_int)localWorkSize;
+
+    HeavyCalculator::PrefixSumKernels kernels;
+    kernels.terms = clCreateKernel(gpuProgram, "HeavyTerms", nullptr);
+    clSetKernelArg(kernels.terms, 0, sizeof(cl_mem), (void*)& buffers.sourceABuffer);
+    clSetKernelArg(kernels.terms, 1, sizeof(cl_mem), (void*)& buffers.sourceBBuffer);
+    clSetKernelArg(kernels.terms, 2, sizeof(cl_mem), (void*)& buffers.termsBuffer);
+    clSetKernelArg(kernels.terms, 3, sizeof(cl_int), (void*)& iNumElements);
+
+    kernels.scanBlocks = clCreateKernel(gpuProgram, "ScanBlocks", nullptr);
+    clSetKernelArg(kernels.scanBlocks, 0, sizeof(cl_mem), (void*)& buffers.termsBuffer);
+    clSetKernelArg(kernels.scanBlocks, 1, sizeof(cl_mem), (void*)& buffers.blockSumsBuffer);
+    clSetKernelArg(kernels.scanBlocks, 2, PREFIX_BYTES * localWorkSize, nullptr);
+
+    kernels.scanBlockSums = clCreateKernel(gpuProgram, "ScanBlockSums", nullptr);
+    clSetKernelArg(kernels.scanBlockSums, 0, sizeof(cl_mem), (void*)& buffers.blockSumsBuffer);
+    clSetKernelArg(kernels.scanBlockSums, 1, sizeof(cl_int), (void*)& numBlocks);
+    clSetKernelArg(kernels.scanBlockSums, 2, PREFIX_BYTES * localWorkSize, nullptr);
+
+    kernels.windowSum = clCreateKernel(gpuProgram, "WindowSum", nullptr);
+    clSetKernelArg(kernels.windowSum, 0, sizeof(cl_mem), (void*)& buffers.termsBuffer);
+    clSetKernelArg(kernels.windowSum, 1, sizeof(cl_mem), (void*)& buffers.blockSumsBuffer);
+    clSetKernelArg(kernels.windowSum, 2, sizeof(cl_mem), (void*)& buffers.dstBuffer);
+    clSetKernelArg(kernels.windowSum, 3, sizeof(cl_int), (void*)& iNumElements);
+    clSetKernelArg(kernels.windowSum, 4, sizeof(cl_int), (void*)& iMaxLoopIdx);
+    clSetKernelArg(kernels.windowSum, 5, sizeof(cl_int), (void*)& blockSize);
+
+    return kernels;
+  }
+
+  void createReducedArgumentBuffers(cl_context gpuContext, size_t globalWorkSize, HeavyCalculator::Buffers& buffers)
+  {
+    auto timer = Timer("Create reduced argument buffers");
+
+    buffers.reducedABuffer = clCreateBuffer(gpuContext, CL_MEM_READ_WRITE, sizeof(cl_float) * globalWorkSize, nullptr, nullptr);
+    buffers.reducedBBuffer = clCreateBuffer(gpuContext, CL_MEM_READ_WRITE, sizeof(cl_float) * globalWorkSize, nullptr, nullptr);
+  }
+
+  cl_kernel createReduceArgumentsKernel(cl_program gpuProgram, HeavyCalculator::Buffers buffers, size_t numElements)
+  {
+    auto timer = Timer("Create range-reduction kernel");
+
+    cl_int iNumElements = (cl_int)numElements;
+    auto kernel = clCreateKernel(gpuProgram, "ReduceArguments", nullptr);
+    clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)& buffers.sourceABuffer);
+    clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)& buffers.sourceBBuffer);
+    clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)& buffers.reducedABuffer);
+    clSetKernelArg(kernel, 3, sizeof(cl_mem), (void*)& buffers.reducedBBuffer);
+    clSetKernelArg(kernel, 4, sizeof(cl_int), (void*)& iNumElements);
+
+    return kernel;
+  }
+
+  cl_kernel createKernel(cl_program gpuProgram, const char* kernelName, HeavyCalculator::Buffers buffers, size_t numElements)
   {
     auto timer = Timer("Create kernel");
 
     // Create the kernel
-    std::cout << "Creating Kernel ..." << std::endl;
-    auto kernel = clCreateKernel(gpuProgram, "HeavyCalculation", nullptr);
+    std::cout << "Creating Kernel " << kernelName << " ..." << std::endl;
+    auto kernel = clCreateKernel(gpuProgram, kernelName, nullptr);
 
     // Set the Argument values
     clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)& buffers.sourceABuffer);
     clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)& buffers.sourceBBuffer);
     clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)& buffers.dstBuffer);
     clSetKernelArg(kernel, 3, sizeof(cl_int), (void*)& numElements);
+    cl_int maxLoopIdx = (cl_int)MAX_LOOP_IDX;
+    clSetKernelArg(kernel, 4, sizeof(cl_int), (void*)& maxLoopIdx);
 
     return kernel;
   }
 
+  // Local work size for the main kernel: freshly tuned, from the tuning database, or LOCAL_WORK_SIZE
+  size_t selectLocalWorkSize(cl_context gpuContext, cl_device_id targetDevice, cl_kernel kernel, const char* kernelName,
+    size_t globalWorkSize, bool autotune)
+  {
+    WorkGroupTuner tuner;
+    size_t localWorkSize = LOCAL_WORK_SIZE;
+    if (autotune)
+    {
+      auto timer = Timer("Autotune local work size");
+      localWorkSize = tuner.tune(gpuContext, targetDevice, kernel, kernelName, globalWorkSize);
+      tuner.save();
+    }
+    else if (tuner.lookup(targetDevice, kernelName, localWorkSize) && (localWorkSize == 0 || globalWorkSize % localWorkSize == 0))
+    {
+      std::cout << "Tuned local work size for " << kernelName << " = " << localWorkSize << std::endl;
+    }
+    else
+    {
+      localWorkSize = LOCAL_WORK_SIZE;
+    }
+    return localWorkSize;
+  }
+
+  // Source and result buffers with host memory of the given mode
+  HeavyCalculator::Buffers createHostBuffers(cl_context gpuContext, HostMemoryMode mode, size_t globalWorkSize,
+    size_t sourceSize, std::vector<void*>& hostMemory)
+  {
+    auto timer = Timer(std::string("Create ") + hostMemoryModeName(mode) + " buffers");
+    HeavyCalculator::Buffers buffers;
+    void* memory = nullptr;
+    buffers.sourceABuffer = createHostBuffer(gpuContext, mode, CL_MEM_READ_ONLY, sizeof(cl_float4) * sourceSize, memory);
+    hostMemory.push_back(memory);
+    buffers.sourceBBuffer = createHostBuffer(gpuContext, mode, CL_MEM_READ_ONLY, sizeof(cl_float4) * sourceSize, memory);
+    hostMemory.push_back(memory);
+    buffers.dstBuffer = createHostBuffer(gpuContext, mode, CL_MEM_WRITE_ONLY, sizeof(cl_float) * globalWorkSize, memory);
+    hostMemory.push_back(memory);
+    return buffers;
+  }
+
+  // Fills the source buffers in place, then keeps them mapped for reading:
+  // kernels may read a buffer mapped for reading, and the host reference reads them at validation
+  void populateMappedInput(cl_command_queue commandQueue, HeavyCalculator::Buffers buffers, Data& data, size_t numElements)
+  {
+    auto timer = Timer("Populate mapped input buffers");
+    const size_t bytes = sizeof(cl_float4) * data.sourceA.size();
+    data.sourceA.attach((cl_float4*)clEnqueueMapBuffer(commandQueue, buffers.sourceABuffer, CL_TRUE, CL_MAP_WRITE,
+      0, bytes, 0, nullptr, profileEvent("map sourceA"), nullptr));
+    data.sourceB.attach((cl_float4*)clEnqueueMapBuffer(commandQueue, buffers.sourceBBuffer, CL_TRUE, CL_MAP_WRITE,
+      0, bytes, 0, nullptr, profileEvent("map sourceB"), nullptr));
+    populateDataInput(data, numElements);
+    clEnqueueUnmapMemObject(commandQueue, buffers.sourceABuffer, data.sourceA.data(), 0, nullptr, profileEvent("unmap sourceA"));
+    clEnqueueUnmapMemObject(commandQueue, buffers.sourceBBuffer, data.sourceB.data(), 0, nullptr, profileEvent("unmap sourceB"));
+
+    data.sourceA.attach((cl_float4*)clEnqueueMapBuffer(commandQueue, buffers.sourceABuffer, CL_TRUE, CL_MAP_READ,
+      0, bytes, 0, nullptr, profileEvent("map sourceA"), nullptr));
+    data.sourceB.attach((cl_float4*)clEnqueueMapBuffer(commandQueue, buffers.sourceBBuffer, CL_TRUE, CL_MAP_READ,
+      0, bytes, 0, nullptr, profileEvent("map sourceB"), nullptr));
+  }
+
+  void unmapData(cl_command_queue commandQueue, HeavyCalculator::Buffers buffers, Data& data)
+  {
+    clEnqueueUnmapMemObject(commandQueue, buffers.sourceABuffer, data.sourceA.data(), 0, nullptr, profileEvent("unmap sourceA"));
+    clEnqueueUnmapMemObject(commandQueue, buffers.sourceBBuffer, data.sourceB.data(), 0, nullptr, profileEvent("unmap sourceB"));
+    if (data.heavyCalculationResults.data())
+      clEnqueueUnmapMemObject(commandQueue, buffers.dstBuffer, data.heavyCalculationResults.data(), 0, nullptr, profileEvent("unmap results"));
+    clFinish(commandQueue);
+    data.sourceA.attach(nullptr);
+    data.sourceB.attach(nullptr);
+    data.heavyCalculationResults.attach(nullptr);
+  }
+
   cl_command_queue createCommandQueue(
     cl_context gpuContext,
     cl_device_id targetDevice,
     HeavyCalculator::Buffers buffers,
-    size_t globalWorkSize,
     const Data& data)
   {
     auto timer = Timer("Create Command Queue and write data to GPU device");
-    auto commandQueue = clCreateCommandQueue(gpuContext, targetDevice, 0, nullptr);
+    auto commandQueue = clCreateCommandQueue(gpuContext, targetDevice, EventProfiler::instance().queueProperties(), nullptr);
 
-    // Asynchronous write of data to GPU device
+    // Asynchronous write of data to GPU device, halo included
     clEnqueueWriteBuffer(commandQueue, buffers.sourceABuffer, CL_FALSE, 0, 
-      sizeof(cl_float) * globalWorkSize * 4, data.sourceA.data(), 0, nullptr, nullptr);
+      sizeof(cl_float4) * data.sourceA.size(), data.sourceA.data(), 0, nullptr, profileEvent("write sourceA"));
     clEnqueueWriteBuffer(commandQueue, buffers.sourceBBuffer, CL_FALSE, 0, 
-      sizeof(cl_float) * globalWorkSize * 4, data.sourceB.data(), 0, nullptr, nullptr);
+      sizeof(cl_float4) * data.sourceB.size(), data.sourceB.data(), 0, nullptr, profileEvent("write sourceB"));
 
     return commandQueue;
   }
 
   void launchKernelAndRun(
     cl_command_queue commandQueue,
+    cl_kernel prepassKernel,
     cl_kernel kernel,
     HeavyCalculator::Buffers buffers,
     size_t globalWorkSize,
     size_t localWorkSize,
-    std::vector<cl_float>& heavyCalculationResults)
+    HostArray<cl_float>& heavyCalculationResults)
   {
     {
       auto timer = Timer("Run calculation and read back results");
-      // Launch kernel
-      clEnqueueNDRangeKernel(commandQueue, kernel, 1, nullptr, &globalWorkSize, &localWorkSize, 0, nullptr, nullptr);
+      // Launch kernels, the optional prepass first; a local work size of 0 lets the driver pick
+      const size_t* localSize = localWorkSize ? &localWorkSize : nullptr;
+      if (prepassKernel)
+        clEnqueueNDRangeKernel(commandQueue, prepassKernel, 1, nullptr, &globalWorkSize, localSize, 0, nullptr, profileKernelEvent(prepassKernel));
+      clEnqueueNDRangeKernel(commandQueue, kernel, 1, nullptr, &globalWorkSize, localSize, 0, nullptr, profileKernelEvent(kernel));
 
-      // Read back results and check accumulated errors
+      // Read back results and check accumulated errors; a work item may produce several results
       clEnqueueReadBuffer(commandQueue, buffers.dstBuffer, CL_TRUE, 0,
-        sizeof(cl_float) * globalWorkSize, heavyCalculationResults.data(), 0, nullptr, nullptr);
+        sizeof(cl_float) * heavyCalculationResults.size(), heavyCalculationResults.data(), 0, nullptr, profileEvent("read results"));
+    }
+  }
+
+  // Mapped variant: the results are read in place from the mapped result buffer, which is unmapped
+  // again before the next launch writes it
+  void launchKernelAndMap(
+    cl_command_queue commandQueue,
+    cl_kernel prepassKernel,
+    cl_kernel kernel,
+    HeavyCalculator::Buffers buffers,
+    size_t globalWorkSize,
+    size_t localWorkSize,
+    HostArray<cl_float>& heavyCalculationResults)
+  {
+    auto timer = Timer("Run calculation and map results");
+    const size_t* localSize = localWorkSize ? &localWorkSize : nullptr;
+    if (heavyCalculationResults.data())
+      clEnqueueUnmapMemObject(commandQueue, buffers.dstBuffer, heavyCalculationResults.data(), 0, nullptr, profileEvent("unmap results"));
+    if (prepassKernel)
+      clEnqueueNDRangeKernel(commandQueue, prepassKernel, 1, nullptr, &globalWorkSize, localSize, 0, nullptr, profileKernelEvent(prepassKernel));
+    clEnqueueNDRangeKernel(commandQueue, kernel, 1, nullptr, &globalWorkSize, localSize, 0, nullptr, profileKernelEvent(kernel));
+    heavyCalculationResults.attach((cl_float*)clEnqueueMapBuffer(commandQueue, buffers.dstBuffer, CL_TRUE, CL_MAP_READ,
+      0, sizeof(cl_float) * heavyCalculationResults.size(), 0, nullptr, profileEvent("map results"), nullptr));
+  }
+
+  void launchPrefixSumAndRun(
+    cl_command_queue commandQueue,
+    HeavyCalculator::PrefixSumKernels kernels,
+    HeavyCalculator::Buffers buffers,
+    size_t globalWorkSize,
+    size_t localWorkSize,
+    HostArray<cl_float>& heavyCalculationResults)
+  {
+    auto timer = Timer("Run prefix-sum calculation and read back results");
+    clEnqueueNDRangeKernel(commandQueue, kernels.terms, 1, nullptr, &globalWorkSize, &localWorkSize, 0, nullptr, profileKernelEvent(kernels.terms));
+    clEnqueueNDRangeKernel(commandQueue, kernels.scanBlocks, 1, nullptr, &globalWorkSize, &localWorkSize, 0, nullptr, profileKernelEvent(kernels.scanBlocks));
+    clEnqueueNDRangeKernel(commandQueue, kernels.scanBlockSums, 1, nullptr, &localWorkSize, &localWorkSize, 0, nullptr, profileKernelEvent(kernels.scanBlockSums));
+    clEnqueueNDRangeKernel(commandQueue, kernels.windowSum, 1, nullptr, &globalWorkSize, &localWorkSize, 0, nullptr, profileKernelEvent(kernels.windowSum));
+
+    clEnqueueReadBuffer(commandQueue, buffers.dstBuffer, CL_TRUE, 0,
+      sizeof(cl_float) * globalWorkSize, heavyCalculationResults.data(), 0, nullptr, profileEvent("read results"));
+  }
+
+  // The device computes [0, deviceCount) while the host pool computes [deviceCount, numElements),
+  // both straight into heavyCalculationResults. Returns the device share that would have balanced this run.
+  double launchCoExecutionAndRun(
+    cl_command_queue commandQueue,
+    cl_kernel prepassKernel,
+    cl_kernel kernel,
+    HeavyCalculator::Buffers buffers,
+    size_t numElements,
+    size_t globalWorkSize,
+    size_t localWorkSize,
+    double deviceShare,
+    Data& data)
+  {
+    auto timer = Timer("Co-execute calculation on device and host");
+    const size_t granularity = localWorkSize ? localWorkSize : LOCAL_WORK_SIZE;
+    const size_t deviceCount = std::min(numElements, size_t(deviceShare * numElements) / granularity * granularity);
+    const size_t* localSize = localWorkSize ? &localWorkSize : nullptr;
+    auto& results = data.heavyCalculationResults;
+
+    auto deviceSeconds = std::async(std::launch::async, [&]()
+    {
+      auto begin = std::chrono::steady_clock::now();
+      if (prepassKernel)
+        clEnqueueNDRangeKernel(commandQueue, prepassKernel, 1, nullptr, &globalWorkSize, localSize, 0, nullptr, profileKernelEvent(prepassKernel));
+      if (deviceCount > 0)
+      {
+        clEnqueueNDRangeKernel(commandQueue, kernel, 1, nullptr, &deviceCount, localSize, 0, nullptr, profileKernelEvent(kernel));
+        clEnqueueReadBuffer(commandQueue, buffers.dstBuffer, CL_TRUE, 0,
+          sizeof(cl_float) * deviceCount, results.data(), 0, nullptr, profileEvent("read results"));
+      }
+      clFinish(commandQueue);
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    });
+
+    auto begin = std::chrono::steady_clock::now();
+    HeavyCalculationRange((const float*)data.sourceA.data(), (const float*)data.sourceB.data(),
+      results.data(), deviceCount, numElements);
+    const double hostTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    const double deviceTime = deviceSeconds.get();
+
+    const size_t hostCount = numElements - deviceCount;
+    std::cout << "  device: " << deviceCount << " elements in " << 1.e3 * deviceTime << " ms, host: "
+      << hostCount << " elements in " << 1.e3 * hostTime << " ms" << std::endl;
+
+    // A side that got nothing cannot be measured, probe it with a bigger share next time
+    const double PROBE_STEP = 0.1;
+    if (deviceCount == 0)
+      return std::min(1.0, deviceShare + PROBE_STEP);
+    if (hostCount == 0)
+      return std::max(0.0, deviceShare - PROBE_STEP);
+    const double deviceRate = deviceCount / std::max(deviceTime, 1.e-9);
+    const double hostRate = hostCount / std::max(hostTime, 1.e-9);
+    return deviceRate / (deviceRate + hostRate);
+  }
+
+  // Average device time of the kernel over a few profiled launches, in ns
+  double profileKernel(cl_command_queue profilingQueue, cl_kernel kernel, size_t globalWorkSize, size_t localWorkSize)
+  {
+    const int REPETITIONS = 10;
+    clEnqueueNDRangeKernel(profilingQueue, kernel, 1, nullptr, &globalWorkSize, &localWorkSize, 0, nullptr, nullptr);
+    clFinish(profilingQueue);
+
+    cl_ulong total = 0;
+    for (int rep = 0; rep < REPETITIONS; ++rep)
+    {
+      cl_event event = nullptr;
+      clEnqueueNDRangeKernel(profilingQueue, kernel, 1, nullptr, &globalWorkSize, &localWorkSize, 0, nullptr, &event);
+      clWaitForEvents(1, &event);
+      cl_ulong start = 0, end = 0;
+      clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+      clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+      clReleaseEvent(event);
+      total += end - start;
+    }
+    return (double)total / REPETITIONS;
+  }
+
+  // Every source element is read and every result written at least once; the window overlap
+  // is served by the caches, so this is the traffic a bandwidth-bound kernel has to move
+  double kernelTrafficBytes(size_t numElements)
+  {
+    return (double)sizeof(cl_float) * numElements * (MAX_LOOP_IDX > 0 ? 3 : 1);
+  }
+
+  void reportVec4Bandwidth(cl_context gpuContext, cl_device_id targetDevice, cl_kernel scalarKernel, cl_kernel vec4Kernel,
+    size_t numElements, size_t globalWorkSize, size_t vec4WorkSize, size_t localWorkSize)
+  {
+    cl_command_queue profilingQueue = clCreateCommandQueue(gpuContext, targetDevice, CL_QUEUE_PROFILING_ENABLE, nullptr);
+    const double scalarNs = profileKernel(profilingQueue, scalarKernel, globalWorkSize, localWorkSize);
+    const double vec4Ns = profileKernel(profilingQueue, vec4Kernel, vec4WorkSize, localWorkSize);
+    clReleaseCommandQueue(profilingQueue);
+
+    const double bytes = kernelTrafficBytes(numElements);
+    std::cout << "HeavyCalculation, " << numElements << " elements x " << MAX_LOOP_IDX << " terms" << std::endl;
+    std::cout << std::setw(8) << "kernel" << std::setw(14) << "time, ms" << std::setw(14) << "GB/s" << std::endl;
+    std::cout << std::setw(8) << "float" << std::setw(14) << scalarNs * 1.e-6 << std::setw(14) << bytes / scalarNs << std::endl;
+    std::cout << std::setw(8) << "float4" << std::setw(14) << vec4Ns * 1.e-6 << std::setw(14) << bytes / vec4Ns << std::endl;
+    std::cout << "float4 speedup = " << scalarNs / std::max(vec4Ns, 1.0) << "x" << std::endl;
+  }
+
+  // Work-item counts proportional to the device throughputs, in multiples of granularity;
+  // the last device with a nonzero throughput takes the remainder
+  std::vector<size_t> splitRange(const std::vector<double>& throughputs, size_t globalWorkSize, size_t granularity)
+  {
+    double total = 0.0;
+    size_t last = 0;
+    for (size_t d = 0; d < throughputs.size(); ++d)
+    {
+      total += throughputs[d];
+      if (throughputs[d] > 0.0)
+        last = d;
+    }
+    std::vector<size_t> counts(throughputs.size(), 0);
+    size_t assigned = 0;
+    for (size_t d = 0; d < last; ++d)
+    {
+      counts[d] = std::min(globalWorkSize - assigned,
+        size_t(throughputs[d] / total * globalWorkSize) / granularity * granularity);
+      assigned += counts[d];
+    }
+    counts[last] = globalWorkSize - assigned;
+    return counts;
+  }
+
+  // Device d computes counts[d] work items after those of devices [0, d), straight into its slice of results.
+  // All queues are flushed before any is waited on, so the devices run concurrently. Returns the wall time in seconds.
+  double launchMultiDeviceAndRun(const std::vector<HeavyCalculator::DeviceResources>& devices,
+    const std::vector<size_t>& counts, size_t localWorkSize, HostArray<cl_float>& results)
+  {
+    auto begin = std::chrono::steady_clock::now();
+    size_t offset = 0;
+    for (size_t d = 0; d < devices.size(); ++d)
+    {
+      if (counts[d] == 0)
+        continue;
+      clEnqueueNDRangeKernel(devices[d].commandQueue, devices[d].kernel, 1, &offset, &counts[d], &localWorkSize, 0, nullptr, profileKernelEvent(devices[d].kernel));
+      clEnqueueReadBuffer(devices[d].commandQueue, devices[d].buffers.dstBuffer, CL_FALSE, sizeof(cl_float) * offset,
+        sizeof(cl_float) * counts[d], results.data() + offset, 0, nullptr, profileEvent("read results"));
+      clFlush(devices[d].commandQueue);
+      offset += counts[d];
+    }
+    for (const auto& device : devices)
+      clFinish(device.commandQueue);
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+  }
+
+  // Source elements [start, start + length) of the wrapped array, as one or more writes to the buffer
+  // from float offset on
+  void enqueueWindowWrite(cl_command_queue commandQueue, cl_mem buffer, const float* source, size_t numElements,
+    size_t start, size_t length, size_t offset = 0)
+  {
+    size_t done = 0;
+    while (done < length)
+    {
+      const size_t k = (start + done) % numElements;
+      const size_t piece = std::min(length - done, numElements - k);
+      clEnqueueWriteBuffer(commandQueue, buffer, CL_FALSE, sizeof(cl_float) * (offset + done), sizeof(cl_float) * piece,
+        source + k, 0, nullptr, profileEvent("write window"));
+      done += piece;
+    }
+  }
+
+  // Chunk c goes to stream c % streams.size(); a stream's queue is in order, so its buffers are reused safely
+  // while the other streams upload and read back
+  void launchStreamingAndRun(const std::vector<HeavyCalculator::DeviceResources>& streams, Data& data,
+    size_t numElements, size_t chunkWorkSize, size_t windowSize, size_t localWorkSize)
+  {
+    auto timer = Timer("Stream chunks through " + std::to_string(streams.size()) + " queues");
+    const float* a = (const float*)data.sourceA.data();
+    const float* b = (const float*)data.sourceB.data();
+    size_t chunk = 0;
+    for (size_t begin = 0; begin < numElements; begin += chunkWorkSize, ++chunk)
+    {
+      const auto& stream = streams[chunk % streams.size()];
+      const size_t count = std::min(chunkWorkSize, numElements - begin);
+      const size_t globalWorkSize = shrRoundUp((int)localWorkSize, count);
+      const cl_int windowStart = (cl_int)((4ll * begin) % numElements);
+
+      enqueueWindowWrite(stream.commandQueue, stream.buffers.sourceABuffer, a, numElements, windowStart, windowSize);
+      enqueueWindowWrite(stream.commandQueue, stream.buffers.sourceBBuffer, b, numElements, windowStart, windowSize);
+      clSetKernelArg(stream.kernel, 5, sizeof(cl_int), (void*)&windowStart);
+      clEnqueueNDRangeKernel(stream.commandQueue, stream.kernel, 1, nullptr, &globalWorkSize, &localWorkSize, 0, nullptr, profileKernelEvent(stream.kernel));
+      clEnqueueReadBuffer(stream.commandQueue, stream.buffers.dstBuffer, CL_FALSE, 0, sizeof(cl_float) * count,
+        data.heavyCalculationResults.data() + begin, 0, nullptr, profileEvent("read results"));
+      clFlush(stream.commandQueue);
+    }
+    for (const auto& stream : streams)
+      clFinish(stream.commandQueue);
+    std::cout << "Streamed " << chunk << " chunks of " << chunkWorkSize << " results, "
+      << 2 * chunk * windowSize * sizeof(cl_float) / (1 << 20) << " MB uploaded" << std::endl;
+  }
+
+  // Tiles run in order on one queue, alternating between the buffer sets. Consecutive windows overlap by
+  // windowSize - 4 * tileWorkSize floats: that part is copied on the device from the previous set and only
+  // the new 4 * tileWorkSize floats are uploaded. Resident sources are uploaded once for all the tiles.
+  void launchTiledAndRun(cl_command_queue commandQueue, const std::vector<HeavyCalculator::DeviceResources>& tiles,
+    Data& data, size_t numElements, size_t tileWorkSize, size_t windowSize, size_t localWorkSize, bool resident)
+  {
+    auto timer = Timer("Run calculation in tiles and read back results");
+    const float* a = (const float*)data.sourceA.data();
+    const float* b = (const float*)data.sourceB.data();
+    const size_t* localSize = localWorkSize ? &localWorkSize : nullptr;
+    const size_t granularity = localWorkSize ? localWorkSize : LOCAL_WORK_SIZE;
+    const size_t overlap = windowSize > 4 * tileWorkSize ? windowSize - 4 * tileWorkSize : 0;
+    size_t uploaded = 0;
+    if (resident)
+    {
+      enqueueWindowWrite(commandQueue, tiles[0].buffers.sourceABuffer, a, numElements, 0, numElements);
+      enqueueWindowWrite(commandQueue, tiles[0].buffers.sourceBBuffer, b, numElements, 0, numElements);
+      uploaded += 2 * numElements;
+    }
+    size_t tile = 0;
+    for (size_t begin = 0; begin < numElements; begin += tileWorkSize, ++tile)
+    {
+      const auto& set = tiles[tile % tiles.size()];
+      const size_t count = std::min(tileWorkSize, numElements - begin);
+      const size_t globalWorkSize = shrRoundUp((int)granularity, count);
+      const cl_int windowStart = (cl_int)((4ll * begin) % numElements);
+
+      size_t reused = 0;
+      if (resident)
+        reused = windowSize;
+      else if (tile > 0 && overlap > 0)
+      {
+        const auto& previous = tiles[(tile - 1) % tiles.size()];
+        reused = overlap;
+        clEnqueueCopyBuffer(commandQueue, previous.buffers.sourceABuffer, set.buffers.sourceABuffer,
+          sizeof(cl_float) * 4 * tileWorkSize, 0, sizeof(cl_float) * reused, 0, nullptr, profileEvent("copy window overlap"));
+        clEnqueueCopyBuffer(commandQueue, previous.buffers.sourceBBuffer, set.buffers.sourceBBuffer,
+          sizeof(cl_float) * 4 * tileWorkSize, 0, sizeof(cl_float) * reused, 0, nullptr, profileEvent("copy window overlap"));
+      }
+      if (reused < windowSize)
+      {
+        enqueueWindowWrite(commandQueue, set.buffers.sourceABuffer, a, numElements, windowStart + reused, windowSize - reused, reused);
+        enqueueWindowWrite(commandQueue, set.buffers.sourceBBuffer, b, numElements, windowStart + reused, windowSize - reused, reused);
+        uploaded += 2 * (windowSize - reused);
+      }
+
+      clSetKernelArg(set.kernel, 5, sizeof(cl_int), (void*)&windowStart);
+      clEnqueueNDRangeKernel(commandQueue, set.kernel, 1, nullptr, &globalWorkSize, localSize, 0, nullptr, profileKernelEvent(set.kernel));
+      clEnqueueReadBuffer(commandQueue, set.buffers.dstBuffer, CL_FALSE, 0, sizeof(cl_float) * count,
+        data.heavyCalculationResults.data() + begin, 0, nullptr, profileEvent("read results"));
+      clFlush(commandQueue);
+    }
+    clFinish(commandQueue);
+    std::cout << "Ran " << tile << " tiles of " << tileWorkSize << " results, "
+      << uploaded * sizeof(cl_float) / (1 << 20) << " MB uploaded" << std::endl;
+  }
+
+  void releaseBuffers(const HeavyCalculator::Buffers& buffers)
+  {
+    for (cl_mem buffer : { buffers.sourceABuffer, buffers.sourceBBuffer, buffers.dstBuffer, buffers.termsBuffer,
+      buffers.blockSumsBuffer, buffers.reducedABuffer, buffers.reducedBBuffer })
+    {
+      if (buffer) clReleaseMemObject(buffer);
+    }
+  }
+
+  // Best of a few blocking transfers of one buffer, per direction. Copy mode moves a host array with
+  // write/read commands; the mapped modes hand the buffer over with unmap and take it back with map.
+  // Average device time of a non-blocking write or read of bytes, in ns
+  double profileTransfer(cl_command_queue profilingQueue, bool upload, cl_mem buffer, size_t bytes, void* hostData)
+  {
+    const int REPETITIONS = 5;
+    cl_ulong total = 0;
+    for (int rep = 0; rep < REPETITIONS; ++rep)
+    {
+      cl_event event = nullptr;
+      if (upload)
+        clEnqueueWriteBuffer(profilingQueue, buffer, CL_FALSE, 0, bytes, hostData, 0, nullptr, &event);
+      else
+        clEnqueueReadBuffer(profilingQueue, buffer, CL_FALSE, 0, bytes, hostData, 0, nullptr, &event);
+      clWaitForEvents(1, &event);
+      cl_ulong start = 0, end = 0;
+      clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+      clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+      clReleaseEvent(event);
+      total += end - start;
+    }
+    return std::max((double)total / REPETITIONS, 1.0);
+  }
+
+  // Device time of the upload, kernel and read-back of one direct run, with the bytes and ops each has to move
+  std::vector<RooflinePhase> measureRooflinePhases(cl_context gpuContext, cl_device_id targetDevice, cl_kernel kernel,
+    const HeavyCalculator::Buffers& buffers, Data& data, size_t numElements, size_t globalWorkSize, size_t localWorkSize)
+  {
+    cl_command_queue profilingQueue = clCreateCommandQueue(gpuContext, targetDevice, CL_QUEUE_PROFILING_ENABLE, nullptr);
+    const size_t sourceBytes = sizeof(cl_float4) * data.sourceA.size();
+    const size_t resultBytes = sizeof(cl_float) * globalWorkSize;
+    std::vector<RooflinePhase> phases;
+    phases.push_back({ "sourceA", RooflinePhase::Upload, (double)sourceBytes, 0.0,
+      profileTransfer(profilingQueue, true, buffers.sourceABuffer, sourceBytes, data.sourceA.data()) });
+    phases.push_back({ "sourceB", RooflinePhase::Upload, (double)sourceBytes, 0.0,
+      profileTransfer(profilingQueue, true, buffers.sourceBBuffer, sourceBytes, data.sourceB.data()) });
+    phases.push_back({ "HeavyCalculation", RooflinePhase::Kernel, kernelTrafficBytes(numElements),
+      FLOPS_PER_TERM * numElements * MAX_LOOP_IDX, profileKernel(profilingQueue, kernel, globalWorkSize, localWorkSize) });
+    phases.push_back({ "results", RooflinePhase::ReadBack, (double)resultBytes, 0.0,
+      profileTransfer(profilingQueue, false, buffers.dstBuffer, resultBytes, data.heavyCalculationResults.data()) });
+    clReleaseCommandQueue(profilingQueue);
+    return phases;
+  }
+
+  void reportHostMemoryBandwidth(cl_context gpuContext, cl_command_queue commandQueue, size_t bytes)
+  {
+    const int REPETITIONS = 5;
+    auto seconds = [](std::chrono::steady_clock::time_point begin)
+    {
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    };
+
+    std::cout << "Host memory transfers of " << bytes / (1 << 20) << " MB" << std::endl;
+    std::cout << std::setw(10) << "mode" << std::setw(16) << "upload, GB/s" << std::setw(18) << "read-back, GB/s" << std::endl;
+    for (auto mode : { HostMemoryMode::Copy, HostMemoryMode::Pinned, HostMemoryMode::ZeroCopy })
+    {
+      void* hostMemory = nullptr;
+      cl_mem buffer = createHostBuffer(gpuContext, mode, CL_MEM_READ_WRITE, bytes, hostMemory);
+      std::vector<char> hostArray(mode == HostMemoryMode::Copy ? bytes : 0, 1);
+      double upload = 0.0, readBack = 0.0;
+      for (int rep = 0; rep < REPETITIONS; ++rep)
+      {
+        double up = 0.0, down = 0.0;
+        if (mode == HostMemoryMode::Copy)
+        {
+          auto begin = std::chrono::steady_clock::now();
+          clEnqueueWriteBuffer(commandQueue, buffer, CL_TRUE, 0, bytes, hostArray.data(), 0, nullptr, nullptr);
+          up = seconds(begin);
+          begin = std::chrono::steady_clock::now();
+          clEnqueueReadBuffer(commandQueue, buffer, CL_TRUE, 0, bytes, hostArray.data(), 0, nullptr, nullptr);
+          down = seconds(begin);
+        }
+        else
+        {
+          // Filled in place outside of the measurement, as populateMappedInput() does
+          void* mapped = clEnqueueMapBuffer(commandQueue, buffer, CL_TRUE, CL_MAP_WRITE, 0, bytes, 0, nullptr, nullptr, nullptr);
+          memset(mapped, 1, bytes);
+          auto begin = std::chrono::steady_clock::now();
+          clEnqueueUnmapMemObject(commandQueue, buffer, mapped, 0, nullptr, nullptr);
+          clFinish(commandQueue);
+          up = seconds(begin);
+          begin = std::chrono::steady_clock::now();
+          mapped = clEnqueueMapBuffer(commandQueue, buffer, CL_TRUE, CL_MAP_READ, 0, bytes, 0, nullptr, nullptr, nullptr);
+          down = seconds(begin);
+          clEnqueueUnmapMemObject(commandQueue, buffer, mapped, 0, nullptr, nullptr);
+          clFinish(commandQueue);
+        }
+        upload = (rep == 0) ? up : std::min(upload, up);
+        readBack = (rep == 0) ? down : std::min(readBack, down);
+      }
+      clReleaseMemObject(buffer);
+      if (hostMemory)
+        freePageAligned(hostMemory);
+
+      std::cout << std::setw(10) << hostMemoryModeName(mode) << std::setw(16) << bytes / std::max(upload, 1.e-9) * 1.e-9
+        << std::setw(18) << bytes / std::max(readBack, 1.e-9) * 1.e-9 << std::endl;
     }
   }
 
@@ -239,63 +1195,661 @@ namespace
         (float*)heavyCalculationResultsValidation.data(), (int)numElements);
     }
 
-    shrBOOL bMatch = shrComparefet((const float*)heavyCalculationResultsValidation.data(), 
-      (const float*)data.heavyCalculationResults.data(), (unsigned int)numElements, 0.0f, 0);
+    bool bMatch = compareResults((const float*)heavyCalculationResultsValidation.data(),
+      (const float*)data.heavyCalculationResults.data(), numElements);
     std::cout << std::boolalpha;
     std::cout << "COMPARING STATUS : " << bMatch << std::endl;
+    std::cout << "Device results against the host direct summation:" << std::endl;
+    reportAccuracy((const float*)heavyCalculationResultsValidation.data(),
+      (const float*)data.heavyCalculationResults.data(), numElements);
   }
 }
 
 
+HeavyCalculator::HeavyCalculator(const Options& options) :
+  options_(options)
+{
+#ifdef TIMER_DISABLED
+  if (options.profiling)
+    std::cout << "Event profiling reports through the Timer scopes, which are compiled out" << std::endl;
+#else
+  EventProfiler::instance().setEnabled(options.profiling || !options.traceFile.empty());
+#endif
+  PerfCounters::instance().setEnabled(options.perfCounters);
+  // Device commands enter the trace through the event profiler
+  if (!options.traceFile.empty())
+    TraceExporter::instance().enable(options.traceFile);
+}
+
 void HeavyCalculator::run()
 {
+  auto firstResultTimer = std::make_unique<Timer>("Time to first result");
 
-  const size_t GLOBAL_WORK_SIZE = shrRoundUp((int)LOCAL_WORK_SIZE, NUM_ELEMENTS);  // rounded up to the nearest multiple of the LocalWorkSize
+  // The float4 kernel produces four results per work item
+  const bool vec4 = options_.vec4 && options_.algorithm == Algorithm::Direct && !options_.rangeReduction &&
+    !options_.haloLayout && !options_.coExecution && NUM_ELEMENTS % 4 == 0;
+  if (options_.vec4 && !vec4)
+    std::cout << "The float4 kernel needs the direct algorithm without other options and NUM_ELEMENTS % 4 == 0, using the scalar kernel" << std::endl;
+  const size_t ELEMENTS_PER_WORK_ITEM = vec4 ? 4 : 1;
+  const size_t GLOBAL_WORK_SIZE = shrRoundUp((int)LOCAL_WORK_SIZE, (NUM_ELEMENTS + ELEMENTS_PER_WORK_ITEM - 1) / ELEMENTS_PER_WORK_ITEM);  // rounded up to the nearest multiple of the LocalWorkSize
+  const size_t RESULT_SIZE = ELEMENTS_PER_WORK_ITEM * GLOBAL_WORK_SIZE;
 
   auto targetDevice = getTargetDevice();
   reportDeviceInfo(targetDevice);
   reportComputationConstants(NUM_ELEMENTS, GLOBAL_WORK_SIZE, LOCAL_WORK_SIZE);
-  Data data(GLOBAL_WORK_SIZE);
-  populateDataInput(data, NUM_ELEMENTS);
+
+  // The halo only removes the modulo while a window wraps at most once
+  const bool rangeReduction = options_.rangeReduction && options_.algorithm == Algorithm::Direct;
+  bool haloLayout = options_.haloLayout && options_.algorithm == Algorithm::Direct && !rangeReduction;
+  if (haloLayout && MAX_LOOP_IDX > NUM_ELEMENTS)
+  {
+    std::cout << "MAX_LOOP_IDX exceeds NUM_ELEMENTS, falling back to the modulo layout" << std::endl;
+    haloLayout = false;
+  }
+  const bool streaming = options_.streaming && options_.algorithm == Algorithm::Direct && !rangeReduction &&
+    !haloLayout && !vec4 && !options_.coExecution;
+
+  // Split the direct kernel into passes when the full-size buffers exceed the device memory, or when asked to
+  const auto memoryLimits = getDeviceMemoryLimits(targetDevice);
+  const size_t sourceFloats = 4 * std::max(RESULT_SIZE, (NUM_ELEMENTS + (haloLayout ? MAX_LOOP_IDX : 0) + 3) / 4);
+  const bool fitsDevice = fitsDeviceMemory(memoryLimits, sourceFloats, RESULT_SIZE);
+  const bool tileable = options_.algorithm == Algorithm::Direct && !rangeReduction && !haloLayout && !vec4 &&
+    !options_.coExecution && !streaming;
+  size_t tileWorkSize = 0;
+  if (tileable && options_.tileSize > 0)
+    tileWorkSize = std::min(GLOBAL_WORK_SIZE, shrRoundUp((int)LOCAL_WORK_SIZE, options_.tileSize));
+  else if (tileable && !fitsDevice)
+    tileWorkSize = selectTileWorkSize(memoryLimits, GLOBAL_WORK_SIZE, LOCAL_WORK_SIZE, MAX_LOOP_IDX, NUM_ELEMENTS);
+  if (!fitsDevice && tileWorkSize == 0)
+    std::cout << "The buffers exceed the device memory and cannot be tiled in this mode, trying anyway" << std::endl;
+  const bool tiled = tileWorkSize > 0;
+
+  // Mapped data is filled and read in place, inside the device buffers
+  const bool mappedData = options_.hostMemory != HostMemoryMode::Copy && options_.algorithm == Algorithm::Direct &&
+    !options_.coExecution && !streaming && !tiled;
+  Data data(RESULT_SIZE, NUM_ELEMENTS, haloLayout ? MAX_LOOP_IDX : 0, !mappedData);
+
+  // Asynchronous startup: the build only needs the context, so it runs on its own thread while the
+  // inputs are generated and the buffers allocated, and is joined right before the first kernel is created
+  std::future<bool> programBuilt;
+  if (options_.asyncBuild)
+  {
+    gpuContext_ = createGPUContext(targetDevice);
+    programBuilt = std::async(std::launch::async, [this, targetDevice]()
+    {
+      return buildProgram(gpuContext_, targetDevice, options_.programCache, gpuProgram_);
+    });
+  }
+  if (!mappedData)
+    populateDataInput(data, NUM_ELEMENTS);
   auto timer = std::make_unique<Timer>("!!!TOTAL GPU TIME!!!");
-  gpuContext_ = createGPUContext(targetDevice);
+  if (!options_.asyncBuild)
+  {
+    gpuContext_ = createGPUContext(targetDevice);
+    if (!buildProgram(gpuContext_, targetDevice, options_.programCache, gpuProgram_))
+      return;
+  }
+  auto programReady = [&programBuilt]()
+  {
+    if (!programBuilt.valid())
+      return true;
+    auto waitTimer = Timer("Wait for the program build");
+    return programBuilt.get();
+  };
 
-  if (!buildProgram(gpuContext_, targetDevice, gpuProgram_))
+  if (streaming)
+  {
+    // A chunk of results reads 4 * (chunkWorkSize - 1) + MAX_LOOP_IDX source elements from its window start
+    const size_t chunkWorkSize = shrRoundUp((int)LOCAL_WORK_SIZE, std::max(options_.chunkSize, 1));
+    const size_t windowSize = MAX_LOOP_IDX > 0 ? 4 * (chunkWorkSize - 1) + MAX_LOOP_IDX : 0;
+    for (size_t s = 0; s < STREAM_COUNT; ++s)
+    {
+      DeviceResources stream;
+      stream.device = targetDevice;
+      stream.commandQueue = clCreateCommandQueue(gpuContext_, targetDevice, EventProfiler::instance().queueProperties(), nullptr);
+      stream.buffers = createBuffers(gpuContext_, chunkWorkSize, std::max<size_t>((windowSize + 3) / 4, 1));
+      streams_.push_back(stream);
+    }
+    if (!programReady())
+      return;
+    const cl_int residentArg = 0;
+    for (auto& stream : streams_)
+    {
+      stream.kernel = createKernel(gpuProgram_, "HeavyCalculationChunk", stream.buffers, NUM_ELEMENTS);
+      clSetKernelArg(stream.kernel, 6, sizeof(cl_int), (void*)&residentArg);
+    }
+    for (int rep = 0; rep < options_.repetitions; ++rep)
+    {
+      launchStreamingAndRun(streams_, data, NUM_ELEMENTS, chunkWorkSize, windowSize, LOCAL_WORK_SIZE);
+    }
+    timer.reset();
+    firstResultTimer.reset();
+    validateCalculation(data, NUM_ELEMENTS);
+    return;
+  }
+
+  if (tiled)
+  {
+    const size_t windowSize = tileWindowSize(tileWorkSize, MAX_LOOP_IDX, NUM_ELEMENTS);
+    const bool resident = MAX_LOOP_IDX > 0 && windowSize == NUM_ELEMENTS;
+    std::cout << "Tiling " << NUM_ELEMENTS << " results into passes of " << tileWorkSize << " (window of "
+      << windowSize << " source floats" << (resident ? ", resident" : "") << ")" << std::endl;
+    commandQueue_ = clCreateCommandQueue(gpuContext_, targetDevice, EventProfiler::instance().queueProperties(), nullptr);
+    for (size_t s = 0; s < TILE_BUFFER_SETS; ++s)
+    {
+      DeviceResources tile;
+      tile.device = targetDevice;
+      if (resident && s > 0)
+      {
+        // The sets share the resident sources; each holds a reference, released with its buffers
+        tile.buffers.sourceABuffer = tiles_[0].buffers.sourceABuffer;
+        tile.buffers.sourceBBuffer = tiles_[0].buffers.sourceBBuffer;
+        clRetainMemObject(tile.buffers.sourceABuffer);
+        clRetainMemObject(tile.buffers.sourceBBuffer);
+        tile.buffers.dstBuffer = clCreateBuffer(gpuContext_, CL_MEM_WRITE_ONLY, sizeof(cl_float) * tileWorkSize, nullptr, nullptr);
+      }
+      else
+        tile.buffers = createBuffers(gpuContext_, tileWorkSize, std::max<size_t>((windowSize + 3) / 4, 1));
+      tiles_.push_back(tile);
+    }
+    if (!programReady())
+      return;
+    const cl_int residentArg = resident ? 1 : 0;
+    for (auto& tile : tiles_)
+    {
+      tile.kernel = createKernel(gpuProgram_, "HeavyCalculationChunk", tile.buffers, NUM_ELEMENTS);
+      clSetKernelArg(tile.kernel, 6, sizeof(cl_int), (void*)&residentArg);
+    }
+    const size_t localWorkSize = selectLocalWorkSize(gpuContext_, targetDevice, tiles_[0].kernel, "HeavyCalculationChunk",
+      tileWorkSize, options_.autotune);
+    for (int rep = 0; rep < options_.repetitions; ++rep)
+    {
+      launchTiledAndRun(commandQueue_, tiles_, data, NUM_ELEMENTS, tileWorkSize, windowSize, localWorkSize, resident);
+    }
+    timer.reset();
+    firstResultTimer.reset();
+    validateCalculation(data, NUM_ELEMENTS);
     return;
+  }
 
-  buffers_ = createBuffers(gpuContext_, GLOBAL_WORK_SIZE);
+  buffers_ = mappedData ?
+    createHostBuffers(gpuContext_, options_.hostMemory, RESULT_SIZE, data.sourceA.size(), hostMemory_) :
+    createBuffers(gpuContext_, RESULT_SIZE, data.sourceA.size());
+  if (!programReady())
+    return;
 
-  kernel_ = createKernel(gpuProgram_, buffers_, NUM_ELEMENTS);
+  const char* kernelName = nullptr;
+
+  if (options_.algorithm == Algorithm::PrefixSum)
+  {
+    createPrefixSumBuffers(gpuContext_, GLOBAL_WORK_SIZE, LOCAL_WORK_SIZE, buffers_);
+    prefixSumKernels_ = createPrefixSumKernels(gpuProgram_, buffers_, NUM_ELEMENTS, MAX_LOOP_IDX, GLOBAL_WORK_SIZE, LOCAL_WORK_SIZE);
+  }
+  else if (rangeReduction)
+  {
+    createReducedArgumentBuffers(gpuContext_, GLOBAL_WORK_SIZE, buffers_);
+    reduceKernel_ = createReduceArgumentsKernel(gpuProgram_, buffers_, NUM_ELEMENTS);
+    // The main kernel reads the reduced arguments instead of the sources
+    auto reducedBuffers = buffers_;
+    reducedBuffers.sourceABuffer = buffers_.reducedABuffer;
+    reducedBuffers.sourceBBuffer = buffers_.reducedBBuffer;
+    kernelName = "HeavyCalculationReduced";
+    kernel_ = createKernel(gpuProgram_, kernelName, reducedBuffers, NUM_ELEMENTS);
+  }
+  else
+  {
+    kernelName = vec4 ? "HeavyCalculationVec4" : haloLayout ? "HeavyCalculationHalo" : "HeavyCalculation";
+    kernel_ = createKernel(gpuProgram_, kernelName, buffers_, NUM_ELEMENTS);
+  }
 
   // --------------------------------------------------------
   // Core sequence... copy input data to GPU, compute, copy results back
 
-  commandQueue_ = createCommandQueue(gpuContext_, targetDevice, buffers_, GLOBAL_WORK_SIZE, data);
+  if (mappedData)
+  {
+    commandQueue_ = clCreateCommandQueue(gpuContext_, targetDevice, EventProfiler::instance().queueProperties(), nullptr);
+    populateMappedInput(commandQueue_, buffers_, data, NUM_ELEMENTS);
+  }
+  else
+  {
+    commandQueue_ = createCommandQueue(gpuContext_, targetDevice, buffers_, data);
+  }
+
+  // The prefix-sum kernels size their local memory and block sums from LOCAL_WORK_SIZE
+  size_t localWorkSize = LOCAL_WORK_SIZE;
+  if (kernel_)
+  {
+    clFinish(commandQueue_);
+    localWorkSize = selectLocalWorkSize(gpuContext_, targetDevice, kernel_, kernelName, GLOBAL_WORK_SIZE, options_.autotune);
+  }
 
-  launchKernelAndRun(commandQueue_, kernel_, buffers_,
-    GLOBAL_WORK_SIZE, LOCAL_WORK_SIZE, data.heavyCalculationResults);
+  if (options_.algorithm == Algorithm::PrefixSum)
+  {
+    launchPrefixSumAndRun(commandQueue_, prefixSumKernels_, buffers_,
+      GLOBAL_WORK_SIZE, LOCAL_WORK_SIZE, data.heavyCalculationResults);
+  }
+  else if (options_.coExecution)
+  {
+    for (int rep = 0; rep < options_.repetitions; ++rep)
+    {
+      const double balancedShare = launchCoExecutionAndRun(commandQueue_, reduceKernel_, kernel_, buffers_,
+        NUM_ELEMENTS, GLOBAL_WORK_SIZE, localWorkSize, deviceShare_, data);
+      // Smooth the measurements, a single noisy run should not swing the split
+      deviceShare_ = 0.5 * deviceShare_ + 0.5 * balancedShare;
+      std::cout << "Device share for the next run = " << deviceShare_ << std::endl;
+    }
+  }
+  else if (mappedData)
+  {
+    for (int rep = 0; rep < options_.repetitions; ++rep)
+    {
+      launchKernelAndMap(commandQueue_, reduceKernel_, kernel_, buffers_,
+        GLOBAL_WORK_SIZE, localWorkSize, data.heavyCalculationResults);
+    }
+  }
+  else
+  {
+    for (int rep = 0; rep < options_.repetitions; ++rep)
+    {
+      launchKernelAndRun(commandQueue_, reduceKernel_, kernel_, buffers_,
+        GLOBAL_WORK_SIZE, localWorkSize, data.heavyCalculationResults);
+    }
+  }
 
   timer.reset();
+  firstResultTimer.reset();
   validateCalculation(data, NUM_ELEMENTS);
+  if (mappedData)
+    unmapData(commandQueue_, buffers_, data);
 
 }
 
+bool HeavyCalculator::setup()
+{
+  if (kernel_)
+    return true;
+
+  auto timer = Timer("Session setup");
+  auto targetDevice = getTargetDevice();
+  gpuContext_ = createGPUContext(targetDevice);
+  if (!buildProgram(gpuContext_, targetDevice, options_.programCache, gpuProgram_))
+    return false;
+
+  // Buffers and the element count are bound by compute()
+  kernel_ = clCreateKernel(gpuProgram_, "HeavyCalculation", nullptr);
+  cl_int maxLoopIdx = (cl_int)MAX_LOOP_IDX;
+  clSetKernelArg(kernel_, 4, sizeof(cl_int), (void*)&maxLoopIdx);
+  commandQueue_ = clCreateCommandQueue(gpuContext_, targetDevice, EventProfiler::instance().queueProperties(), nullptr);
+
+  // The tuning database winner of run(), looked up once for all jobs; 0 lets the driver pick
+  sessionLocalWorkSize_ = LOCAL_WORK_SIZE;
+  if (WorkGroupTuner().lookup(targetDevice, "HeavyCalculation", sessionLocalWorkSize_))
+    std::cout << "Tuned local work size for HeavyCalculation = " << sessionLocalWorkSize_ << std::endl;
+  return kernel_ != 0 && commandQueue_ != 0;
+}
+
+bool HeavyCalculator::compute(const float* a, const float* b, float* c, size_t numElements)
+{
+  if (numElements == 0)
+    return true;
+  if (!setup())
+    return false;
+
+  const size_t globalWorkSize = shrRoundUp((int)(sessionLocalWorkSize_ ? sessionLocalWorkSize_ : LOCAL_WORK_SIZE), numElements);
+  if (globalWorkSize > sessionCapacity_)
+  {
+    // Grow only, so a series of similar jobs allocates once
+    clFinish(commandQueue_);
+    releaseBuffers(buffers_);
+    buffers_ = createBuffers(gpuContext_, globalWorkSize, (globalWorkSize + 3) / 4);
+    sessionCapacity_ = globalWorkSize;
+    clSetKernelArg(kernel_, 0, sizeof(cl_mem), (void*)&buffers_.sourceABuffer);
+    clSetKernelArg(kernel_, 1, sizeof(cl_mem), (void*)&buffers_.sourceBBuffer);
+    clSetKernelArg(kernel_, 2, sizeof(cl_mem), (void*)&buffers_.dstBuffer);
+  }
+  if (numElements != sessionNumElements_)
+  {
+    cl_int iNumElements = (cl_int)numElements;
+    clSetKernelArg(kernel_, 3, sizeof(cl_int), (void*)&iNumElements);
+    sessionNumElements_ = numElements;
+  }
+
+  // In-order queue: the blocking read-back also completes the uploads and the kernel
+  const size_t bytes = sizeof(cl_float) * numElements;
+  cl_int status = clEnqueueWriteBuffer(commandQueue_, buffers_.sourceABuffer, CL_FALSE, 0, bytes, a, 0, nullptr, nullptr);
+  status |= clEnqueueWriteBuffer(commandQueue_, buffers_.sourceBBuffer, CL_FALSE, 0, bytes, b, 0, nullptr, nullptr);
+  status |= clEnqueueNDRangeKernel(commandQueue_, kernel_, 1, nullptr, &globalWorkSize,
+    sessionLocalWorkSize_ ? &sessionLocalWorkSize_ : nullptr, 0, nullptr, nullptr);
+  status |= clEnqueueReadBuffer(commandQueue_, buffers_.dstBuffer, CL_TRUE, 0, bytes, c, 0, nullptr, nullptr);
+  return status == CL_SUCCESS;
+}
+
+void HeavyCalculator::benchmarkSession()
+{
+  const int NUM_JOBS = 1000;
+  const size_t MAX_JOB_SIZE = 1 << 16;
+  std::vector<cl_float> a(MAX_JOB_SIZE), b(MAX_JOB_SIZE), c(MAX_JOB_SIZE), reference(MAX_JOB_SIZE);
+  fillArray(a.data(), MAX_JOB_SIZE);
+  fillArray(b.data(), MAX_JOB_SIZE);
+
+  auto begin = std::chrono::steady_clock::now();
+  if (!setup())
+    return;
+  const double setupMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+  // Job sizes vary, so both the grow and the rebind paths are taken
+  bool match = true;
+  begin = std::chrono::steady_clock::now();
+  for (int job = 0; job < NUM_JOBS; ++job)
+  {
+    const size_t numElements = MAX_JOB_SIZE >> (job % 4);
+    if (!compute(a.data(), b.data(), c.data(), numElements))
+    {
+      std::cout << "compute() failed in job " << job << std::endl;
+      return;
+    }
+    if (job < 4)
+    {
+      HeavyCalculationScalar(a.data(), b.data(), reference.data(), 0, (int)numElements, (int)numElements, (int)MAX_LOOP_IDX);
+      match = compareResults(reference.data(), c.data(), numElements) && match;
+    }
+  }
+  const double jobsMs = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - begin).count();
+
+  std::cout << std::boolalpha;
+  std::cout << "COMPARING STATUS : " << match << std::endl;
+  std::cout << "Session setup " << setupMs << " ms, " << NUM_JOBS << " jobs of up to " << MAX_JOB_SIZE
+    << " elements: " << jobsMs / NUM_JOBS << " ms per job" << std::endl;
+}
+
+void HeavyCalculator::runMultiDevice()
+{
+  const size_t GLOBAL_WORK_SIZE = shrRoundUp((int)LOCAL_WORK_SIZE, NUM_ELEMENTS);  // rounded up to the nearest multiple of the LocalWorkSize
+
+  auto deviceIds = getAllDevices();
+  if (deviceIds.empty())
+    return;
+  reportComputationConstants(NUM_ELEMENTS, GLOBAL_WORK_SIZE, LOCAL_WORK_SIZE);
+
+  Data data(GLOBAL_WORK_SIZE, NUM_ELEMENTS);
+  populateDataInput(data, NUM_ELEMENTS);
+  auto timer = std::make_unique<Timer>("!!!TOTAL MULTI-DEVICE TIME!!!");
+  {
+    auto contextTimer = Timer("Creating multi-device context");
+    gpuContext_ = clCreateContext(nullptr, (cl_uint)deviceIds.size(), deviceIds.data(), nullptr, nullptr, nullptr);
+  }
+  for (auto deviceId : deviceIds)
+    alignTraceClock(gpuContext_, deviceId);
+  // A cache entry holds the binary of one device
+  if (!buildProgram(gpuContext_, deviceIds[0], options_.programCache && deviceIds.size() == 1, gpuProgram_))
+    return;
+
+  // Every device reads the whole source arrays, the windows wrap around anywhere
+  for (auto deviceId : deviceIds)
+  {
+    DeviceResources device;
+    device.device = deviceId;
+    device.buffers = createBuffers(gpuContext_, GLOBAL_WORK_SIZE, data.sourceA.size());
+    device.kernel = createKernel(gpuProgram_, "HeavyCalculation", device.buffers, NUM_ELEMENTS);
+    device.commandQueue = createCommandQueue(gpuContext_, deviceId, device.buffers, data);
+    devices_.push_back(device);
+  }
+  for (const auto& device : devices_)
+    clFinish(device.commandQueue);
+
+  // Standalone throughput of every device over the whole range, after a warm-up launch;
+  // it sets the split and is the baseline of the scaling table
+  const size_t numDevices = devices_.size();
+  std::vector<double> throughputs(numDevices, 0.0);
+  for (size_t d = 0; d < numDevices; ++d)
+  {
+    std::vector<size_t> counts(numDevices, 0);
+    counts[d] = GLOBAL_WORK_SIZE;
+    launchMultiDeviceAndRun(devices_, counts, LOCAL_WORK_SIZE, data.heavyCalculationResults);
+    const double seconds = launchMultiDeviceAndRun(devices_, counts, LOCAL_WORK_SIZE, data.heavyCalculationResults);
+    throughputs[d] = GLOBAL_WORK_SIZE / std::max(seconds, 1.e-9);
+    std::cout << "Device " << d << " alone: " << 1.e3 * seconds << " ms" << std::endl;
+  }
+
+  // Scaling over the first n devices; the last row uses all of them and leaves its results for validation
+  std::cout << std::setw(8) << "devices" << std::setw(12) << "time, ms" << std::setw(10) << "speedup"
+    << std::setw(12) << "efficiency" << "  split" << std::endl;
+  double sumThroughput = 0.0;
+  for (size_t n = 1; n <= numDevices; ++n)
+  {
+    sumThroughput += throughputs[n - 1];
+    std::vector<double> active(throughputs.begin(), throughputs.begin() + n);
+    active.resize(numDevices, 0.0);
+    const auto counts = splitRange(active, GLOBAL_WORK_SIZE, LOCAL_WORK_SIZE);
+    const int repetitions = std::max(1, options_.repetitions);
+    double seconds = 0.0;
+    for (int rep = 0; rep < repetitions; ++rep)
+      seconds += launchMultiDeviceAndRun(devices_, counts, LOCAL_WORK_SIZE, data.heavyCalculationResults);
+    seconds /= repetitions;
+
+    const double throughput = GLOBAL_WORK_SIZE / std::max(seconds, 1.e-9);
+    std::cout << std::setw(8) << n << std::setw(12) << 1.e3 * seconds << std::setw(10) << throughput / throughputs[0]
+      << std::setw(12) << throughput / sumThroughput << " ";
+    for (size_t d = 0; d < n; ++d)
+      std::cout << " " << counts[d];
+    std::cout << std::endl;
+  }
+
+  timer.reset();
+  validateCalculation(data, NUM_ELEMENTS);
+}
+
+void HeavyCalculator::benchmarkHost()
+{
+  Data data(NUM_ELEMENTS);
+  populateDataInput(data, NUM_ELEMENTS);
+  benchmarkThreadPool((const float*)data.sourceA.data(), (const float*)data.sourceB.data(), NUM_ELEMENTS);
+}
+
+void HeavyCalculator::benchmarkSimd()
+{
+  Data data(NUM_ELEMENTS);
+  populateDataInput(data, NUM_ELEMENTS);
+  reportSimdThroughput((const float*)data.sourceA.data(), (const float*)data.sourceB.data(), NUM_ELEMENTS);
+}
+
+void HeavyCalculator::benchmarkPrefixSum()
+{
+  Data data(NUM_ELEMENTS);
+  populateDataInput(data, NUM_ELEMENTS);
+  reportPrefixSumBenchmark((const float*)data.sourceA.data(), (const float*)data.sourceB.data(), NUM_ELEMENTS);
+}
+
+void HeavyCalculator::benchmarkRangeReduction()
+{
+  Data data(NUM_ELEMENTS);
+  populateDataInput(data, NUM_ELEMENTS);
+  reportRangeReductionBenchmark((const float*)data.sourceA.data(), (const float*)data.sourceB.data(), NUM_ELEMENTS);
+}
+
+void HeavyCalculator::benchmarkVec4()
+{
+  const size_t GLOBAL_WORK_SIZE = shrRoundUp((int)LOCAL_WORK_SIZE, NUM_ELEMENTS);
+  const size_t VEC4_WORK_SIZE = shrRoundUp((int)LOCAL_WORK_SIZE, (NUM_ELEMENTS + 3) / 4);
+  const size_t RESULT_SIZE = std::max(GLOBAL_WORK_SIZE, 4 * VEC4_WORK_SIZE);
+  if (NUM_ELEMENTS % 4 != 0)
+  {
+    std::cout << "The float4 kernel needs NUM_ELEMENTS % 4 == 0" << std::endl;
+    return;
+  }
+
+  auto targetDevice = getTargetDevice();
+  reportDeviceInfo(targetDevice);
+  Data data(RESULT_SIZE, NUM_ELEMENTS);
+  populateDataInput(data, NUM_ELEMENTS);
+  gpuContext_ = createGPUContext(targetDevice);
+  if (!buildProgram(gpuContext_, targetDevice, options_.programCache, gpuProgram_))
+    return;
+
+  buffers_ = createBuffers(gpuContext_, RESULT_SIZE, data.sourceA.size());
+  kernel_ = createKernel(gpuProgram_, "HeavyCalculation", buffers_, NUM_ELEMENTS);
+  cl_kernel vec4Kernel = createKernel(gpuProgram_, "HeavyCalculationVec4", buffers_, NUM_ELEMENTS);
+  commandQueue_ = createCommandQueue(gpuContext_, targetDevice, buffers_, data);
+  clFinish(commandQueue_);
+
+  reportVec4Bandwidth(gpuContext_, targetDevice, kernel_, vec4Kernel, NUM_ELEMENTS, GLOBAL_WORK_SIZE, VEC4_WORK_SIZE, LOCAL_WORK_SIZE);
+  clReleaseKernel(vec4Kernel);
+}
+
+void HeavyCalculator::benchmarkHostMemory()
+{
+  const size_t GLOBAL_WORK_SIZE = shrRoundUp((int)LOCAL_WORK_SIZE, NUM_ELEMENTS);
+
+  auto targetDevice = getTargetDevice();
+  reportDeviceInfo(targetDevice);
+  gpuContext_ = createGPUContext(targetDevice);
+  commandQueue_ = clCreateCommandQueue(gpuContext_, targetDevice, 0, nullptr);
+  // The size of one source array
+  reportHostMemoryBandwidth(gpuContext_, commandQueue_, sizeof(cl_float4) * GLOBAL_WORK_SIZE);
+}
+
+void HeavyCalculator::benchmarkRoofline()
+{
+  const size_t GLOBAL_WORK_SIZE = shrRoundUp((int)LOCAL_WORK_SIZE, NUM_ELEMENTS);
+
+  auto targetDevice = getTargetDevice();
+  reportDeviceInfo(targetDevice);
+  Data data(GLOBAL_WORK_SIZE, NUM_ELEMENTS);
+  populateDataInput(data, NUM_ELEMENTS);
+  gpuContext_ = createGPUContext(targetDevice);
+  if (!buildProgram(gpuContext_, targetDevice, options_.programCache, gpuProgram_))
+    return;
+  buffers_ = createBuffers(gpuContext_, GLOBAL_WORK_SIZE, data.sourceA.size());
+  kernel_ = createKernel(gpuProgram_, "HeavyCalculation", buffers_, NUM_ELEMENTS);
+
+  // The microkernels stream buffers as large as one source array
+  const auto peaks = measureDevicePeaks(gpuContext_, targetDevice, sizeof(cl_float4) * data.sourceA.size());
+  const auto phases = measureRooflinePhases(gpuContext_, targetDevice, kernel_, buffers_, data, NUM_ELEMENTS,
+    GLOBAL_WORK_SIZE, LOCAL_WORK_SIZE);
+  std::cout << "HeavyCalculation, " << NUM_ELEMENTS << " elements x " << MAX_LOOP_IDX << " terms" << std::endl;
+  switch (reportRoofline(peaks, phases))
+  {
+  case RooflineBound::Transfer:
+    std::cout << "Transfers dominate: try --pinned, --zero-copy or --stream" << std::endl;
+    break;
+  case RooflineBound::Memory:
+    std::cout << "The kernel dominates and is memory-bound: try --vec4 or --halo" << std::endl;
+    break;
+  case RooflineBound::Compute:
+    std::cout << "The kernel dominates and is compute-bound: try --reduce-args or --prefix-sum" << std::endl;
+    break;
+  }
+}
+
 HeavyCalculator::~HeavyCalculator()
 {
-  if (buffers_.sourceABuffer) clReleaseMemObject(buffers_.sourceABuffer);
-  if (buffers_.sourceBBuffer) clReleaseMemObject(buffers_.sourceBBuffer);
-  if (buffers_.dstBuffer) clReleaseMemObject(buffers_.dstBuffer);
+  releaseBuffers(buffers_);
+  for (const auto& device : devices_)
+  {
+    releaseBuffers(device.buffers);
+    if (device.kernel) clReleaseKernel(device.kernel);
+    if (device.commandQueue) clReleaseCommandQueue(device.commandQueue);
+  }
+  for (const auto& stream : streams_)
+  {
+    releaseBuffers(stream.buffers);
+    if (stream.kernel) clReleaseKernel(stream.kernel);
+    if (stream.commandQueue) clReleaseCommandQueue(stream.commandQueue);
+  }
+  for (const auto& tile : tiles_)
+  {
+    releaseBuffers(tile.buffers);
+    if (tile.kernel) clReleaseKernel(tile.kernel);
+  }
   if (kernel_) clReleaseKernel(kernel_);
+  if (reduceKernel_) clReleaseKernel(reduceKernel_);
+  if (prefixSumKernels_.terms) clReleaseKernel(prefixSumKernels_.terms);
+  if (prefixSumKernels_.scanBlocks) clReleaseKernel(prefixSumKernels_.scanBlocks);
+  if (prefixSumKernels_.scanBlockSums) clReleaseKernel(prefixSumKernels_.scanBlockSums);
+  if (prefixSumKernels_.windowSum) clReleaseKernel(prefixSumKernels_.windowSum);
   if (gpuProgram_) clReleaseProgram(gpuProgram_);
   if (commandQueue_) clReleaseCommandQueue(commandQueue_);
   if (gpuContext_) clReleaseContext(gpuContext_);
+  for (void* memory : hostMemory_)
+  {
+    if (memory) freePageAligned(memory);
+  }
 }
 
 
 // *********************************************************************
 int main(int argc, char** argv)
 {
-  HeavyCalculator heavyCalculator;
+  HeavyCalculator::Options options;
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "prefix-sum"))
+    options.algorithm = HeavyCalculator::Algorithm::PrefixSum;
+  options.haloLayout = shrCheckCmdLineFlag(argc, (const char**)argv, "halo") == shrTRUE;
+  options.rangeReduction = shrCheckCmdLineFlag(argc, (const char**)argv, "reduce-args") == shrTRUE;
+  options.vec4 = shrCheckCmdLineFlag(argc, (const char**)argv, "vec4") == shrTRUE;
+  options.coExecution = shrCheckCmdLineFlag(argc, (const char**)argv, "co-exec") == shrTRUE;
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "pinned"))
+    options.hostMemory = HostMemoryMode::Pinned;
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "zero-copy"))
+    options.hostMemory = HostMemoryMode::ZeroCopy;
+  options.streaming = shrCheckCmdLineFlag(argc, (const char**)argv, "stream") == shrTRUE;
+  shrGetCmdLineArgumenti(argc, (const char**)argv, "chunk", &options.chunkSize);
+  shrGetCmdLineArgumenti(argc, (const char**)argv, "tile", &options.tileSize);
+  shrGetCmdLineArgumenti(argc, (const char**)argv, "runs", &options.repetitions);
+  options.programCache = shrCheckCmdLineFlag(argc, (const char**)argv, "no-program-cache") == shrFALSE;
+  options.autotune = shrCheckCmdLineFlag(argc, (const char**)argv, "autotune") == shrTRUE;
+  options.profiling = shrCheckCmdLineFlag(argc, (const char**)argv, "profile") == shrTRUE;
+  options.asyncBuild = shrCheckCmdLineFlag(argc, (const char**)argv, "async-build") == shrTRUE;
+  options.perfCounters = shrCheckCmdLineFlag(argc, (const char**)argv, "perf-counters") == shrTRUE;
+  char* traceFile = nullptr;
+  if (shrGetCmdLineArgumentstr(argc, (const char**)argv, "trace", &traceFile) && traceFile)
+    options.traceFile = traceFile;
+
+  HeavyCalculator heavyCalculator(options);
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "benchmark-pool"))
+  {
+    heavyCalculator.benchmarkHost();
+    return 0;
+  }
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "benchmark-simd"))
+  {
+    heavyCalculator.benchmarkSimd();
+    return 0;
+  }
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "benchmark-prefix"))
+  {
+    heavyCalculator.benchmarkPrefixSum();
+    return 0;
+  }
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "benchmark-reduction"))
+  {
+    heavyCalculator.benchmarkRangeReduction();
+    return 0;
+  }
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "multi-device"))
+  {
+    heavyCalculator.runMultiDevice();
+    return 0;
+  }
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "benchmark-host-memory"))
+  {
+    heavyCalculator.benchmarkHostMemory();
+    return 0;
+  }
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "benchmark-session"))
+  {
+    heavyCalculator.benchmarkSession();
+    return 0;
+  }
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "benchmark-vec4"))
+  {
+    heavyCalculator.benchmarkVec4();
+    return 0;
+  }
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "benchmark-roofline"))
+  {
+    heavyCalculator.benchmarkRoofline();
+    return 0;
+  }
   heavyCalculator.run();
   return 0;
 }
\ No newline at end of file
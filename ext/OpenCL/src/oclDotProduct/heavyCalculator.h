@@ -1,19 +1,133 @@
 #pragma once
+#include <string>
+#include <vector>
+
+#include "hostMemory.h"
+
 class HeavyCalculator
 {
 public:
+  enum class Algorithm
+  {
+    Direct,    // every c[i] sums its MAX_LOOP_IDX terms
+    PrefixSum  // every term is evaluated once, c[i] is a wrap-around window of a prefix-sum array
+  };
+  struct Options
+  {
+    Algorithm algorithm = Algorithm::Direct;
+    // Source arrays carry a copy of their first MAX_LOOP_IDX elements at the end (direct algorithm only)
+    bool haloLayout = false;
+    // Reduce k * a[k] and k * b[k] modulo 2*pi in a prepass, the main kernel then uses fast sin/cos (direct algorithm only)
+    bool rangeReduction = false;
+    // float4 loads, every work item produces four consecutive results (direct algorithm, modulo layout only)
+    bool vec4 = false;
+    // Stream the range in chunks through STREAM_COUNT queues, overlapping upload, compute and read-back
+    // (direct algorithm, modulo layout only)
+    bool streaming = false;
+    // Results per streamed chunk, rounded up to the local work size
+    int chunkSize = 1 << 16;
+    // Results per pass when the direct kernel is tiled to fit the device memory (modulo layout only);
+    // 0 tiles automatically, and only when the full-size buffers exceed CL_DEVICE_MAX_MEM_ALLOC_SIZE
+    // or the usable share of CL_DEVICE_GLOBAL_MEM_SIZE
+    int tileSize = 0;
+    // Split the range between the device and the host thread pool (not with the prefix-sum algorithm)
+    bool coExecution = false;
+    // Host side of the source and result buffers (direct algorithm, not with co-execution or streaming)
+    HostMemoryMode hostMemory = HostMemoryMode::Copy;
+    // Number of calculation runs per run() call; the co-execution split adapts from run to run
+    int repetitions = 1;
+    // Load the program from the on-disk binary cache when possible (see programCache.h)
+    bool programCache = true;
+    // Sweep the local work sizes of the main kernel and store the winner in the tuning database
+    // (see workGroupTuner.h); without it a stored winner is used when there is one
+    bool autotune = false;
+    // Profile every write, kernel and read with events, reported with the Timer scopes (see eventProfiler.h)
+    bool profiling = false;
+    // Build the program on a background thread while run() generates the inputs and allocates the buffers
+    bool asyncBuild = false;
+    // Chrome trace of the run (host scopes, host chunks, device commands) written here at exit, see traceExporter.h
+    std::string traceFile;
+    // Cycles, instructions, LLC and branch misses and FP vector ops of the host phases (see perfCounters.h)
+    bool perfCounters = false;
+  };
+
+  HeavyCalculator() = default;
+  explicit HeavyCalculator(const Options& options);
   void run();
+  // Long-lived session for many jobs: setup() creates the context, program, kernel and queue once,
+  // compute() then only grows the device buffers when a job is bigger than any before it.
+  // A session object is used either this way or with run(), not both.
+  bool setup();
+  // c[i], i < numElements, from the sources a and b of numElements floats each (direct algorithm);
+  // calls setup() on first use
+  bool compute(const float* a, const float* b, float* c, size_t numElements);
+  // Setup cost against the per-job latency of a series of compute() calls
+  void benchmarkSession();
+  // Direct kernel over every device of the platform, one queue each, the range split by measured throughput
+  void runMultiDevice();
+  // Host-only comparison of the thread pool against the std::async fan-out, needs no OpenCL device
+  void benchmarkHost();
+  // Per-ISA throughput table of the SIMD HeavyCalculationCPU kernels, host only as well
+  void benchmarkSimd();
+  // Host-only timing and accuracy of the prefix-sum algorithm against the direct summation
+  void benchmarkPrefixSum();
+  // Host-only speedup and error of the range-reduction prepass against the direct path
+  void benchmarkRangeReduction();
+  // Device time and effective bandwidth of the float4 kernel against the scalar one
+  void benchmarkVec4();
+  // Upload and read-back bandwidth of every HostMemoryMode
+  void benchmarkHostMemory();
+  // Achieved GB/s and GFLOP/s of the upload, kernel and read-back against the device peaks, with the bound of each
+  // (see roofline.h)
+  void benchmarkRoofline();
   ~HeavyCalculator();
   struct Buffers
   {
     cl_mem sourceABuffer = 0;
     cl_mem sourceBBuffer = 0;
     cl_mem dstBuffer = 0;
+    // Prefix-sum mode only
+    cl_mem termsBuffer = 0;
+    cl_mem blockSumsBuffer = 0;
+    // Range-reduction mode only
+    cl_mem reducedABuffer = 0;
+    cl_mem reducedBBuffer = 0;
+  };
+  struct PrefixSumKernels
+  {
+    cl_kernel terms = 0;
+    cl_kernel scanBlocks = 0;
+    cl_kernel scanBlockSums = 0;
+    cl_kernel windowSum = 0;
+  };
+  // Multi-device and streaming modes: every device or stream has its own queue, kernel and buffers
+  // (the tiled mode leaves the queue empty and uses the shared one)
+  struct DeviceResources
+  {
+    cl_device_id device = 0;
+    cl_command_queue commandQueue = 0;
+    cl_kernel kernel = 0;
+    Buffers buffers;
   };
 private:
+  Options options_;
+  // Fraction of the elements given to the device in co-execution mode, kept across runs
+  double deviceShare_ = 0.5;
   Buffers buffers_;
   cl_kernel kernel_ = 0;
+  cl_kernel reduceKernel_ = 0;
+  PrefixSumKernels prefixSumKernels_;
   cl_program gpuProgram_ = 0;
   cl_command_queue commandQueue_ = 0;
   cl_context gpuContext_ = 0;
+  std::vector<DeviceResources> devices_;
+  // Session state: result capacity of buffers_, the element count the kernel is bound to and the local work size
+  size_t sessionCapacity_ = 0;
+  size_t sessionNumElements_ = 0;
+  size_t sessionLocalWorkSize_ = 0;
+  std::vector<DeviceResources> streams_;
+  // Tiled mode: buffer sets and kernels sharing commandQueue_
+  std::vector<DeviceResources> tiles_;
+  // Page-aligned memory behind the zero-copy buffers, freed after them
+  std::vector<void*> hostMemory_;
 };
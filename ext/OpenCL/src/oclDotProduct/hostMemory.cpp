@@ -0,0 +1,59 @@
+#include "hostMemory.h"
+
+#include <cstdlib>
+
+#if defined(_WIN32)
+#include <malloc.h>
+#endif
+
+namespace
+{
+  // Page size, also a multiple of CL_DEVICE_MEM_BASE_ADDR_ALIGN on the devices we target
+  const size_t PAGE_SIZE = 4096;
+}
+
+const char* hostMemoryModeName(HostMemoryMode mode)
+{
+  switch (mode)
+  {
+  case HostMemoryMode::Pinned: return "pinned";
+  case HostMemoryMode::ZeroCopy: return "zero-copy";
+  default: return "copy";
+  }
+}
+
+void* allocatePageAligned(size_t bytes)
+{
+  // Whole pages, so the driver can pin the range without touching foreign allocations
+  bytes = (bytes + PAGE_SIZE - 1) / PAGE_SIZE * PAGE_SIZE;
+#if defined(_WIN32)
+  return _aligned_malloc(bytes, PAGE_SIZE);
+#else
+  void* memory = nullptr;
+  return posix_memalign(&memory, PAGE_SIZE, bytes) == 0 ? memory : nullptr;
+#endif
+}
+
+void freePageAligned(void* memory)
+{
+#if defined(_WIN32)
+  _aligned_free(memory);
+#else
+  free(memory);
+#endif
+}
+
+cl_mem createHostBuffer(cl_context context, HostMemoryMode mode, cl_mem_flags flags, size_t bytes, void*& hostMemory)
+{
+  hostMemory = nullptr;
+  switch (mode)
+  {
+  case HostMemoryMode::Pinned:
+    return clCreateBuffer(context, flags | CL_MEM_ALLOC_HOST_PTR, bytes, nullptr, nullptr);
+  case HostMemoryMode::ZeroCopy:
+    hostMemory = allocatePageAligned(bytes);
+    return clCreateBuffer(context, flags | CL_MEM_USE_HOST_PTR, bytes, hostMemory, nullptr);
+  default:
+    return clCreateBuffer(context, flags, bytes, nullptr, nullptr);
+  }
+}
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <vector>
+
+#include <oclUtils.h>
+
+// Host side of the device buffers.
+// Copy:     ordinary host arrays, moved with clEnqueueWriteBuffer/clEnqueueReadBuffer (a staging copy on most drivers)
+// Pinned:   CL_MEM_ALLOC_HOST_PTR buffers, filled and read in place through clEnqueueMapBuffer
+// ZeroCopy: CL_MEM_USE_HOST_PTR over page-aligned host memory; CPU and integrated devices use it without any copy
+enum class HostMemoryMode
+{
+  Copy,
+  Pinned,
+  ZeroCopy
+};
+
+const char* hostMemoryModeName(HostMemoryMode mode);
+
+// Array that either owns its storage or views memory owned elsewhere, e.g. a mapped buffer
+template <class T>
+class HostArray
+{
+public:
+  // allocate = false leaves the array empty until attach()
+  explicit HostArray(size_t size, bool allocate = true) :
+    storage_(allocate ? size : 0),
+    data_(allocate ? storage_.data() : nullptr),
+    size_(size)
+  {}
+  HostArray(const HostArray&) = delete;
+  HostArray& operator=(const HostArray&) = delete;
+
+  void attach(T* data) { data_ = data; }
+
+  T* data() { return data_; }
+  const T* data() const { return data_; }
+  size_t size() const { return size_; }
+
+private:
+  std::vector<T> storage_;
+  T* data_;
+  size_t size_;
+};
+
+// Buffer of the given mode; for ZeroCopy the page-aligned host memory is returned in hostMemory
+// and must be released with freePageAligned() after the buffer
+cl_mem createHostBuffer(cl_context context, HostMemoryMode mode, cl_mem_flags flags, size_t bytes, void*& hostMemory);
+
+void* allocatePageAligned(size_t bytes);
+void freePageAligned(void* memory);
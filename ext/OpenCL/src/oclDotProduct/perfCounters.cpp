@@ -0,0 +1,269 @@
+#include "perfCounters.h"
+
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+#include <memory>
+#include <sstream>
+
+#if defined(__linux__)
+#define PERF_COUNTERS_LINUX
+#include <errno.h>
+#include <fstream>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <cpuid.h>
+#endif
+#endif
+
+namespace
+{
+  const char* COUNTER_NAMES[PerfCounters::COUNTER_COUNT] = { "cycles", "instructions", "LLC misses", "branch misses", "FP vector ops" };
+
+  // First reason a counter could not be opened, reported once with the table
+  std::mutex reasonMutex;
+  std::string unavailableReason[PerfCounters::COUNTER_COUNT];
+
+  void setUnavailable(int counter, const std::string& reason)
+  {
+    std::lock_guard<std::mutex> lock(reasonMutex);
+    if (unavailableReason[counter].empty())
+      unavailableReason[counter] = reason;
+  }
+
+#ifdef PERF_COUNTERS_LINUX
+  bool isIntel()
+  {
+#if defined(__x86_64__) || defined(__i386__)
+    unsigned int eax, ebx, ecx, edx;
+    if (!__get_cpuid(0, &eax, &ebx, &ecx, &edx))
+      return false;
+    return ebx == 0x756e6547 && edx == 0x49656e69 && ecx == 0x6c65746e;  // "GenuineIntel"
+#else
+    return false;
+#endif
+  }
+
+  // FP_ARITH_INST_RETIRED (event 0xC7) with every packed single/double umask, 128 to 512 bits.
+  // Other vendors have no equivalent architectural event, so the counter stays n/a there.
+  bool counterConfig(int counter, perf_event_attr& attr)
+  {
+    switch (counter)
+    {
+    case PerfCounters::Cycles:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      return true;
+    case PerfCounters::Instructions:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      return true;
+    case PerfCounters::LlcMisses:
+      attr.type = PERF_TYPE_HW_CACHE;
+      attr.config = PERF_COUNT_HW_CACHE_LL | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+      return true;
+    case PerfCounters::BranchMisses:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_BRANCH_MISSES;
+      return true;
+    case PerfCounters::FpVectorOps:
+      if (!isIntel())
+        return false;
+      attr.type = PERF_TYPE_RAW;
+      attr.config = 0xc7 | (0xfc << 8);
+      return true;
+    default:
+      return false;
+    }
+  }
+
+  std::string openError(int error)
+  {
+    std::string reason = std::string("perf_event_open: ") + strerror(error);
+    if (error == EACCES || error == EPERM)
+    {
+      std::ifstream paranoid("/proc/sys/kernel/perf_event_paranoid");
+      int level = 0;
+      if (paranoid >> level)
+        reason += " (kernel.perf_event_paranoid = " + std::to_string(level) + ")";
+    }
+    return reason;
+  }
+#endif
+}
+
+// Counters of one thread, opened on its first PerfScope and closed when the thread exits
+struct ThreadCounters
+{
+  int fds[PerfCounters::COUNTER_COUNT];
+
+  ThreadCounters()
+  {
+    for (int counter = 0; counter < PerfCounters::COUNTER_COUNT; ++counter)
+    {
+      fds[counter] = -1;
+#ifdef PERF_COUNTERS_LINUX
+      perf_event_attr attr;
+      memset(&attr, 0, sizeof(attr));
+      attr.size = sizeof(attr);
+      if (!counterConfig(counter, attr))
+      {
+        setUnavailable(counter, "no such event on this CPU");
+        continue;
+      }
+      // User space only, which perf_event_paranoid 2 still allows; the times scale multiplexed counts
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+      attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+      fds[counter] = (int)syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+      if (fds[counter] < 0)
+        setUnavailable(counter, openError(errno));
+#else
+      setUnavailable(counter, "perf_event_open needs Linux");
+#endif
+    }
+  }
+
+  ~ThreadCounters()
+  {
+#ifdef PERF_COUNTERS_LINUX
+    for (int fd : fds)
+    {
+      if (fd >= 0)
+        close(fd);
+    }
+#endif
+  }
+
+  // value, time enabled, time running
+  bool read(int counter, uint64_t sample[3]) const
+  {
+#ifdef PERF_COUNTERS_LINUX
+    return fds[counter] >= 0 && ::read(fds[counter], sample, 3 * sizeof(uint64_t)) == 3 * sizeof(uint64_t);
+#else
+    return false;
+#endif
+  }
+};
+
+PerfCounters& PerfCounters::instance()
+{
+  static PerfCounters counters;
+  return counters;
+}
+
+void PerfCounters::add(const char* phase, const double* values, const bool* valid)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto& totals = phases_[phase];
+  totals.calls++;
+  for (int counter = 0; counter < COUNTER_COUNT; ++counter)
+  {
+    if (!valid[counter])
+      continue;
+    totals.values[counter] += values[counter];
+    totals.valid[counter] = true;
+  }
+}
+
+void PerfCounters::report()
+{
+  std::map<std::string, Phase> phases;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    phases.swap(phases_);
+  }
+  if (phases.empty())
+    return;
+
+  bool anyValid = false;
+  for (const auto& entry : phases)
+  {
+    for (bool valid : entry.second.valid)
+      anyValid = anyValid || valid;
+  }
+  std::lock_guard<std::mutex> reasonLock(reasonMutex);
+  if (!anyValid)
+  {
+    std::cout << "Hardware counters unavailable: " << unavailableReason[Cycles] << std::endl;
+    return;
+  }
+
+  std::ostringstream out;
+  out << std::left << std::setw(30) << "Hardware counters, millions" << std::right << std::setw(8) << "calls";
+  for (const char* name : COUNTER_NAMES)
+    out << std::setw(15) << name;
+  out << std::setw(7) << "IPC" << "\n" << std::fixed;
+  for (const auto& entry : phases)
+  {
+    const Phase& phase = entry.second;
+    out << "  " << std::left << std::setw(28) << entry.first.substr(0, 27) << std::right << std::setw(8) << phase.calls
+      << std::setprecision(3);
+    for (int counter = 0; counter < COUNTER_COUNT; ++counter)
+    {
+      if (phase.valid[counter])
+        out << std::setw(15) << phase.values[counter] * 1.e-6;
+      else
+        out << std::setw(15) << "n/a";
+    }
+    if (phase.valid[Cycles] && phase.valid[Instructions] && phase.values[Cycles] > 0)
+      out << std::setw(7) << std::setprecision(2) << phase.values[Instructions] / phase.values[Cycles];
+    else
+      out << std::setw(7) << "n/a";
+    out << "\n";
+  }
+  for (int counter = 0; counter < COUNTER_COUNT; ++counter)
+  {
+    if (!unavailableReason[counter].empty())
+      out << "  " << COUNTER_NAMES[counter] << " unavailable: " << unavailableReason[counter] << "\n";
+  }
+  std::cout << out.str() << std::flush;
+}
+
+PerfCounters::~PerfCounters()
+{
+  report();
+}
+
+PerfScope::PerfScope(const char* phase) :
+  phase_(phase)
+{
+  if (!PerfCounters::instance().enabled())
+    return;
+  thread_local std::unique_ptr<ThreadCounters> threadCounters;
+  if (!threadCounters)
+    threadCounters = std::make_unique<ThreadCounters>();
+  counters_ = threadCounters.get();
+  for (int counter = 0; counter < PerfCounters::COUNTER_COUNT; ++counter)
+  {
+    if (!counters_->read(counter, begin_[counter]))
+      begin_[counter][0] = begin_[counter][1] = begin_[counter][2] = 0;
+  }
+}
+
+PerfScope::~PerfScope()
+{
+  if (!counters_)
+    return;
+  double values[PerfCounters::COUNTER_COUNT];
+  bool valid[PerfCounters::COUNTER_COUNT];
+  for (int counter = 0; counter < PerfCounters::COUNTER_COUNT; ++counter)
+  {
+    uint64_t end[3];
+    valid[counter] = counters_->read(counter, end);
+    if (!valid[counter])
+      continue;
+    const uint64_t value = end[0] - begin_[counter][0];
+    const uint64_t enabled = end[1] - begin_[counter][1];
+    const uint64_t running = end[2] - begin_[counter][2];
+    // A multiplexed counter is extrapolated over its share of the scope; never scheduled, it has no value
+    if (running > 0)
+      values[counter] = (double)value * enabled / running;
+    else
+      values[counter] = 0.0;
+    valid[counter] = running > 0 || enabled == 0;
+  }
+  PerfCounters::instance().add(phase_, values, valid);
+}
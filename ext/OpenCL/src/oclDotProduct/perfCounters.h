@@ -0,0 +1,65 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+
+// Hardware counters per named host phase, from Linux perf_event_open: cycles, instructions,
+// LLC misses, branch misses and retired FP vector operations. A PerfScope reads the calling thread's
+// counters at both ends and adds the difference to its phase, so a phase run by the pool workers sums
+// over all of them. Counters that cannot be opened (other OS, perf_event_paranoid, a VM without a PMU,
+// no FP event for the CPU) are printed as n/a; the report runs after the Timer scopes and at exit.
+class PerfCounters
+{
+public:
+  enum Counter
+  {
+    Cycles,
+    Instructions,
+    LlcMisses,
+    BranchMisses,
+    FpVectorOps,
+    COUNTER_COUNT
+  };
+
+  static PerfCounters& instance();
+
+  void setEnabled(bool enabled) { enabled_ = enabled; }
+  bool enabled() const { return enabled_; }
+
+  // Prints the phases measured since the last report
+  void report();
+  ~PerfCounters();
+
+private:
+  friend class PerfScope;
+  struct Phase
+  {
+    uint64_t calls = 0;
+    double values[COUNTER_COUNT] = {};
+    bool valid[COUNTER_COUNT] = {};
+  };
+
+  PerfCounters() = default;
+  void add(const char* phase, const double* values, const bool* valid);
+
+  bool enabled_ = false;
+  std::mutex mutex_;
+  std::map<std::string, Phase> phases_;
+};
+
+// Counts the enclosing block into phase; costs one flag test when the counters are off
+class PerfScope
+{
+public:
+  explicit PerfScope(const char* phase);
+  ~PerfScope();
+  PerfScope(const PerfScope&) = delete;
+  PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+  const char* phase_;
+  struct ThreadCounters* counters_ = nullptr;
+  uint64_t begin_[PerfCounters::COUNTER_COUNT][3];
+};
@@ -0,0 +1,235 @@
+#include "programCache.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  const char CACHE_MAGIC[8] = { 'O', 'C', 'L', 'B', 'I', 'N', '0', '1' };
+
+  uint64_t fnv1a(const std::string& text)
+  {
+    uint64_t hash = 14695981039346656037ull;
+    for (unsigned char c : text)
+    {
+      hash ^= c;
+      hash *= 1099511628211ull;
+    }
+    return hash;
+  }
+
+  std::string deviceString(cl_device_id device, cl_device_info param)
+  {
+    size_t size = 0;
+    clGetDeviceInfo(device, param, 0, nullptr, &size);
+    std::string value(size, '\0');
+    clGetDeviceInfo(device, param, size, &value[0], nullptr);
+    return value.c_str();
+  }
+
+  std::string platformString(cl_platform_id platform, cl_platform_info param)
+  {
+    size_t size = 0;
+    clGetPlatformInfo(platform, param, 0, nullptr, &size);
+    std::string value(size, '\0');
+    clGetPlatformInfo(platform, param, size, &value[0], nullptr);
+    return value.c_str();
+  }
+
+  // Everything that makes a binary reusable; the source only enters through its hash
+  std::string cacheIdentity(cl_device_id device, const char* source, const char* buildOptions)
+  {
+    cl_platform_id platform = 0;
+    clGetDeviceInfo(device, CL_DEVICE_PLATFORM, sizeof(platform), &platform, nullptr);
+
+    std::ostringstream identity;
+    identity << "source=" << std::hex << fnv1a(source) << std::dec
+      << "\ndevice=" << deviceString(device, CL_DEVICE_NAME)
+      << "\nvendor=" << deviceString(device, CL_DEVICE_VENDOR)
+      << "\ndeviceVersion=" << deviceString(device, CL_DEVICE_VERSION)
+      << "\ndriver=" << deviceString(device, CL_DRIVER_VERSION)
+      << "\nplatform=" << platformString(platform, CL_PLATFORM_NAME)
+      << "\nplatformVersion=" << platformString(platform, CL_PLATFORM_VERSION)
+      << "\noptions=" << (buildOptions ? buildOptions : "");
+    return identity.str();
+  }
+
+  std::filesystem::path cacheEntryPath(const std::string& cacheDirectory, const std::string& identity)
+  {
+    std::ostringstream name;
+    name << std::hex << fnv1a(identity) << ".bin";
+    return std::filesystem::path(cacheDirectory) / name.str();
+  }
+
+  bool readEntry(const std::filesystem::path& path, const std::string& identity, std::vector<unsigned char>& binary)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      return false;
+
+    char magic[sizeof(CACHE_MAGIC)];
+    uint64_t identitySize = 0;
+    uint64_t binarySize = 0;
+    if (!file.read(magic, sizeof(magic)) || !std::equal(magic, magic + sizeof(magic), CACHE_MAGIC))
+      return false;
+    if (!file.read((char*)&identitySize, sizeof(identitySize)) || identitySize != identity.size())
+      return false;
+    std::string storedIdentity(identitySize, '\0');
+    if (!file.read(&storedIdentity[0], identitySize) || storedIdentity != identity)
+      return false;
+    if (!file.read((char*)&binarySize, sizeof(binarySize)) || binarySize == 0)
+      return false;
+    // The binary ends the entry; a stored size that disagrees with the file is a damaged entry, not an allocation
+    std::error_code error;
+    const uintmax_t fileSize = std::filesystem::file_size(path, error);
+    const std::streamoff offset = file.tellg();
+    if (error || offset < 0 || binarySize != fileSize - (uintmax_t)offset)
+      return false;
+    binary.resize(binarySize);
+    return (bool)file.read((char*)binary.data(), binarySize);
+  }
+
+  // Writes to a uniquely named temporary file and renames it over the entry
+  void writeEntry(const std::filesystem::path& path, const std::string& identity, const char* binary, size_t binarySize)
+  {
+    std::error_code error;
+    std::filesystem::create_directories(path.parent_path(), error);
+
+    std::ostringstream suffix;
+    suffix << "." << std::hash<std::thread::id>()(std::this_thread::get_id()) << "."
+      << std::chrono::steady_clock::now().time_since_epoch().count() << "." << std::random_device()() << ".tmp";
+    auto tmpPath = path;
+    tmpPath += suffix.str();
+
+    {
+      std::ofstream file(tmpPath, std::ios::binary | std::ios::trunc);
+      const uint64_t identitySize = identity.size();
+      const uint64_t size = binarySize;
+      file.write(CACHE_MAGIC, sizeof(CACHE_MAGIC));
+      file.write((const char*)&identitySize, sizeof(identitySize));
+      file.write(identity.data(), identity.size());
+      file.write((const char*)&size, sizeof(size));
+      file.write(binary, binarySize);
+      if (!file.flush())
+      {
+        file.close();
+        std::filesystem::remove(tmpPath, error);
+        return;
+      }
+    }
+
+    std::filesystem::rename(tmpPath, path, error);
+    if (error)
+    {
+      std::cout << "Program cache: could not store " << path.string() << ": " << error.message() << std::endl;
+      std::filesystem::remove(tmpPath, error);
+    }
+  }
+
+  // The binary of the program for one of its devices. Queried directly rather than through
+  // oclGetProgBinary, which asks for CL_PROGRAM_BINARIES with a zero-sized array.
+  bool getProgramBinary(cl_program program, cl_device_id device, std::vector<unsigned char>& binary)
+  {
+    cl_uint numDevices = 0;
+    if (clGetProgramInfo(program, CL_PROGRAM_NUM_DEVICES, sizeof(numDevices), &numDevices, nullptr) != CL_SUCCESS || numDevices == 0)
+      return false;
+    std::vector<cl_device_id> devices(numDevices);
+    if (clGetProgramInfo(program, CL_PROGRAM_DEVICES, sizeof(cl_device_id) * numDevices, devices.data(), nullptr) != CL_SUCCESS)
+      return false;
+    const auto deviceIt = std::find(devices.begin(), devices.end(), device);
+    if (deviceIt == devices.end())
+      return false;
+    const size_t deviceIdx = deviceIt - devices.begin();
+
+    std::vector<size_t> sizes(numDevices);
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARY_SIZES, sizeof(size_t) * numDevices, sizes.data(), nullptr) != CL_SUCCESS
+      || sizes[deviceIdx] == 0)
+      return false;
+    std::vector<std::vector<unsigned char>> binaries(numDevices);
+    std::vector<unsigned char*> pointers(numDevices);
+    for (size_t i = 0; i < numDevices; ++i)
+    {
+      binaries[i].resize(sizes[i]);
+      pointers[i] = sizes[i] > 0 ? binaries[i].data() : nullptr;
+    }
+    if (clGetProgramInfo(program, CL_PROGRAM_BINARIES, sizeof(unsigned char*) * numDevices, pointers.data(), nullptr) != CL_SUCCESS)
+      return false;
+    binary.swap(binaries[deviceIdx]);
+    return true;
+  }
+
+  cl_program loadFromBinary(cl_context context, cl_device_id device, const std::vector<unsigned char>& binary,
+    const char* buildOptions)
+  {
+    const unsigned char* binaryData = binary.data();
+    const size_t binarySize = binary.size();
+    cl_int binaryStatus = CL_SUCCESS;
+    cl_int status = CL_SUCCESS;
+    cl_program program = clCreateProgramWithBinary(context, 1, &device, &binarySize, &binaryData, &binaryStatus, &status);
+    if (status != CL_SUCCESS || binaryStatus != CL_SUCCESS)
+    {
+      if (program)
+        clReleaseProgram(program);
+      return 0;
+    }
+    // Binaries still have to be built, which is cheap but can fail on a driver mismatch
+    if (clBuildProgram(program, 1, &device, buildOptions, nullptr, nullptr) != CL_SUCCESS)
+    {
+      clReleaseProgram(program);
+      return 0;
+    }
+    return program;
+  }
+}
+
+std::string programCacheDirectory()
+{
+  const char* directory = getenv("OCL_PROGRAM_CACHE_DIR");
+  return (directory && *directory) ? directory : "oclProgramCache";
+}
+
+cl_int buildProgramCached(cl_context context, cl_device_id device, const char* source,
+  const char* buildOptions, const std::string& cacheDirectory, cl_program& program)
+{
+  const auto identity = cacheIdentity(device, source, buildOptions);
+  const auto path = cacheEntryPath(cacheDirectory, identity);
+
+  std::vector<unsigned char> cachedBinary;
+  if (readEntry(path, identity, cachedBinary))
+  {
+    program = loadFromBinary(context, device, cachedBinary, buildOptions);
+    if (program)
+    {
+      std::cout << "Program cache hit: " << path.string() << std::endl;
+      return CL_SUCCESS;
+    }
+    std::cout << "Program cache entry rejected by the driver, rebuilding from source" << std::endl;
+  }
+
+  size_t sourceSize = strlen(source);
+  program = clCreateProgramWithSource(context, 1, &source, &sourceSize, nullptr);
+  cl_int status = clBuildProgram(program, 1, &device, buildOptions, nullptr, nullptr);
+  if (status != CL_SUCCESS)
+    return status;
+
+  std::vector<unsigned char> binary;
+  if (getProgramBinary(program, device, binary))
+  {
+    writeEntry(path, identity, (const char*)binary.data(), binary.size());
+    std::cout << "Program cache miss, stored " << path.string() << std::endl;
+  }
+  else
+  {
+    std::cout << "Program cache miss, the driver returned no binary to store" << std::endl;
+  }
+  return status;
+}
@@ -0,0 +1,19 @@
+#pragma once
+
+#include <string>
+
+#include <oclUtils.h>
+
+// Persistent cache of OpenCL program binaries.
+// Entries are keyed by a hash of the program source, the device/driver/platform identity and the
+// build options. The full identity is stored in the entry as well, so a hash collision or a stale
+// entry is detected on load. Entries are written to a temporary file and renamed into place, so
+// concurrent processes only ever see complete files.
+
+// Cache directory: $OCL_PROGRAM_CACHE_DIR if set, "oclProgramCache" in the working directory otherwise
+std::string programCacheDirectory();
+
+// Builds the program for the device, from a cached binary when a matching entry exists and from
+// source otherwise (storing the result). Returns the clBuildProgram status of the source build.
+cl_int buildProgramCached(cl_context context, cl_device_id device, const char* source,
+  const char* buildOptions, const std::string& cacheDirectory, cl_program& program);
@@ -0,0 +1,49 @@
+#include "rangeReduction.h"
+
+#include <math.h>
+
+namespace
+{
+  const double TWO_PI = 6.28318530717958647692;
+}
+
+void reduceArguments(const float* a, const float* b, float* reducedA, float* reducedB, int kMin, int kMax)
+{
+  for (int k = kMin; k < kMax; k++)
+  {
+    reducedA[k] = (float)remainder((double)k * a[k], TWO_PI);
+    reducedB[k] = (float)remainder((double)k * b[k], TWO_PI);
+  }
+}
+
+void HeavyCalculationReducedScalar(const float* reducedA, const float* reducedB, float* c,
+  int iMin, int iMax, int numElements, int maxLoopIdx)
+{
+  for (int i = iMin; i < iMax; i++)
+  {
+    float sum = 0.0f;
+    int k = (int)((4ll * i) % numElements);
+    for (int ind = 0; ind < maxLoopIdx; ind++)
+    {
+      sum += sinf(reducedA[k]) * cosf(reducedB[k]);
+      if (++k == numElements)
+        k = 0;
+    }
+    c[i] = sum;
+  }
+}
+
+void HeavyCalculationDoubleReference(const float* a, const float* b, double* c,
+  int iMin, int iMax, int numElements, int maxLoopIdx)
+{
+  for (int i = iMin; i < iMax; i++)
+  {
+    double sum = 0.0;
+    for (int ind = 0; ind < maxLoopIdx; ind++)
+    {
+      int k = (int)((4ll * i + ind) % numElements);
+      sum += sin((double)k * a[k]) * cos((double)k * b[k]);
+    }
+    c[i] = sum;
+  }
+}
@@ -0,0 +1,15 @@
+#pragma once
+
+// Argument range-reduction prepass for HeavyCalculation.
+// The arguments k * a[k] and k * b[k] reach ~NUM_ELEMENTS, which pushes sin/cos into their slow
+// large-argument paths. The prepass reduces them once per element, in double precision, to [-pi, pi].
+
+void reduceArguments(const float* a, const float* b, float* reducedA, float* reducedB, int kMin, int kMax);
+
+// Same window sum as HeavyCalculationScalar, but over the reduced arguments: sin(reducedA[k]) * cos(reducedB[k])
+void HeavyCalculationReducedScalar(const float* reducedA, const float* reducedB, float* c,
+  int iMin, int iMax, int numElements, int maxLoopIdx);
+
+// Ground truth for accuracy reports: double-precision arguments and libm
+void HeavyCalculationDoubleReference(const float* a, const float* b, double* c,
+  int iMin, int iMax, int numElements, int maxLoopIdx);
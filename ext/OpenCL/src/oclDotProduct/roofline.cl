@@ -0,0 +1,9 @@
+const char * CL_PROGRAM_ROOFLINE = R"( 
+// Stream triad a[i] = b[i] + s * c[i]: three floats of global traffic per work item and no reuse,
+// the closest a kernel gets to the sustainable device memory bandwidth
+ __kernel void StreamTriad (__global float* a, __global const float* b, __global const float* c, float s)
+{
+    int i = get_global_id(0);
+    a[i] = b[i] + s * c[i];
+}
+)";
\ No newline at end of file
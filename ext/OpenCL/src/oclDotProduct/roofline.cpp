@@ -0,0 +1,217 @@
+#include "roofline.h"
+
+#include <algorithm>
+#include <cstring>
+#include <iomanip>
+#include <iostream>
+
+#include "roofline.cl"
+
+namespace
+{
+  const int REPETITIONS = 5;
+
+  bool hasExtension(cl_device_id device, const char* extension)
+  {
+    size_t size = 0;
+    clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, 0, nullptr, &size);
+    std::string extensions(size, '\0');
+    clGetDeviceInfo(device, CL_DEVICE_EXTENSIONS, size, &extensions[0], nullptr);
+    return (" " + extensions + " ").find(std::string(" ") + extension + " ") != std::string::npos;
+  }
+
+  double eventNs(cl_event event)
+  {
+    clWaitForEvents(1, &event);
+    cl_ulong start = 0, end = 0;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+    clReleaseEvent(event);
+    return (double)(end - start);
+  }
+
+  // Best of REPETITIONS, in ns; enqueue returns the event of one run
+  template <class Enqueue>
+  double bestNs(Enqueue enqueue)
+  {
+    double best = 0.0;
+    for (int rep = 0; rep < REPETITIONS; ++rep)
+    {
+      const double ns = eventNs(enqueue());
+      best = (rep == 0) ? ns : std::min(best, ns);
+    }
+    return std::max(best, 1.0);
+  }
+
+  double measureStreamTriad(cl_context context, cl_device_id device, cl_command_queue queue, cl_mem a, cl_mem b, cl_mem c, size_t numElements)
+  {
+    size_t programSize = strlen(CL_PROGRAM_ROOFLINE);
+    cl_program program = clCreateProgramWithSource(context, 1, &CL_PROGRAM_ROOFLINE, &programSize, nullptr);
+    if (clBuildProgram(program, 1, &device, nullptr, nullptr, nullptr) != CL_SUCCESS)
+    {
+      oclLogBuildInfo(program, device);
+      clReleaseProgram(program);
+      return 0.0;
+    }
+    cl_kernel kernel = clCreateKernel(program, "StreamTriad", nullptr);
+    const cl_float scale = 3.0f;
+    clSetKernelArg(kernel, 0, sizeof(cl_mem), &a);
+    clSetKernelArg(kernel, 1, sizeof(cl_mem), &b);
+    clSetKernelArg(kernel, 2, sizeof(cl_mem), &c);
+    clSetKernelArg(kernel, 3, sizeof(cl_float), &scale);
+    clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &numElements, nullptr, 0, nullptr, nullptr);  // warmup
+    const double ns = bestNs([&]()
+    {
+      cl_event event = nullptr;
+      clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &numElements, nullptr, 0, nullptr, &event);
+      return event;
+    });
+    clReleaseKernel(kernel);
+    clReleaseProgram(program);
+    return 3.0 * sizeof(cl_float) * numElements / ns;
+  }
+
+  const char* phaseKindName(RooflinePhase::Kind kind)
+  {
+    switch (kind)
+    {
+    case RooflinePhase::Upload: return "upload";
+    case RooflinePhase::ReadBack: return "read-back";
+    default: return "kernel";
+    }
+  }
+}
+
+DevicePeaks theoreticalPeaks(cl_device_id device)
+{
+  DevicePeaks peaks;
+  cl_uint computeUnits = 0, clockMHz = 0, vectorWidth = 0;
+  clGetDeviceInfo(device, CL_DEVICE_MAX_COMPUTE_UNITS, sizeof(computeUnits), &computeUnits, nullptr);
+  clGetDeviceInfo(device, CL_DEVICE_MAX_CLOCK_FREQUENCY, sizeof(clockMHz), &clockMHz, nullptr);
+  clGetDeviceInfo(device, CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT, sizeof(vectorWidth), &vectorWidth, nullptr);
+
+  int coresPerUnit = -1;
+  if (hasExtension(device, "cl_nv_device_attribute_query"))
+  {
+    cl_uint major = 0, minor = 0;
+    clGetDeviceInfo(device, CL_DEVICE_COMPUTE_CAPABILITY_MAJOR_NV, sizeof(major), &major, nullptr);
+    clGetDeviceInfo(device, CL_DEVICE_COMPUTE_CAPABILITY_MINOR_NV, sizeof(minor), &minor, nullptr);
+    coresPerUnit = ConvertSMVer2Cores((int)major, (int)minor);
+  }
+  peaks.coresFromSmVersion = coresPerUnit > 0;
+  if (coresPerUnit <= 0)
+    coresPerUnit = (int)std::max<cl_uint>(vectorWidth, 1);
+
+  peaks.clockMHz = clockMHz;
+  peaks.cores = coresPerUnit * (int)computeUnits;
+  peaks.gflops = 2.0 * peaks.cores * clockMHz * 1.e-3;
+  return peaks;
+}
+
+DevicePeaks measureDevicePeaks(cl_context context, cl_device_id device, size_t bufferBytes)
+{
+  DevicePeaks peaks = theoreticalPeaks(device);
+
+  cl_ulong maxAlloc = 0, globalMem = 0;
+  clGetDeviceInfo(device, CL_DEVICE_MAX_MEM_ALLOC_SIZE, sizeof(maxAlloc), &maxAlloc, nullptr);
+  clGetDeviceInfo(device, CL_DEVICE_GLOBAL_MEM_SIZE, sizeof(globalMem), &globalMem, nullptr);
+  const size_t numElements = (size_t)std::min<cl_ulong>(std::min<cl_ulong>(bufferBytes, maxAlloc), globalMem / 4) / sizeof(cl_float);
+  if (numElements == 0)
+    return peaks;
+  const size_t bytes = sizeof(cl_float) * numElements;
+
+  cl_command_queue queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, nullptr);
+  cl_mem buffers[3];
+  for (auto& buffer : buffers)
+    buffer = clCreateBuffer(context, CL_MEM_READ_WRITE, bytes, nullptr, nullptr);
+  std::vector<cl_float> host(numElements, 1.0f);
+
+  peaks.uploadGBs = bytes / bestNs([&]()
+  {
+    cl_event event = nullptr;
+    clEnqueueWriteBuffer(queue, buffers[1], CL_FALSE, 0, bytes, host.data(), 0, nullptr, &event);
+    return event;
+  });
+  clEnqueueWriteBuffer(queue, buffers[2], CL_TRUE, 0, bytes, host.data(), 0, nullptr, nullptr);
+  peaks.memoryGBs = measureStreamTriad(context, device, queue, buffers[0], buffers[1], buffers[2], numElements);
+  peaks.readBackGBs = bytes / bestNs([&]()
+  {
+    cl_event event = nullptr;
+    clEnqueueReadBuffer(queue, buffers[0], CL_FALSE, 0, bytes, host.data(), 0, nullptr, &event);
+    return event;
+  });
+
+  for (auto buffer : buffers)
+    clReleaseMemObject(buffer);
+  clReleaseCommandQueue(queue);
+  return peaks;
+}
+
+const char* rooflineBoundName(RooflineBound bound)
+{
+  switch (bound)
+  {
+  case RooflineBound::Transfer: return "transfer-bound";
+  case RooflineBound::Memory: return "memory-bound";
+  default: return "compute-bound";
+  }
+}
+
+RooflineBound reportRoofline(const DevicePeaks& peaks, const std::vector<RooflinePhase>& phases)
+{
+  std::cout << std::fixed << std::setprecision(2);
+  std::cout << "Device peaks: " << peaks.gflops << " GFLOP/s (" << peaks.cores << " cores x " << peaks.clockMHz << " MHz x 2"
+    << (peaks.coresFromSmVersion ? "" : ", core count estimated") << "), stream "
+    << peaks.memoryGBs << " GB/s, upload " << peaks.uploadGBs << " GB/s, read-back " << peaks.readBackGBs << " GB/s" << std::endl;
+  const double ridge = peaks.memoryGBs > 0.0 ? peaks.gflops / peaks.memoryGBs : 0.0;
+  std::cout << "Ridge point: " << ridge << " FLOP/byte" << std::endl;
+
+  std::cout << std::left << std::setw(24) << "phase" << std::right << std::setw(12) << "time, ms" << std::setw(10) << "GB/s"
+    << std::setw(10) << "GFLOP/s" << std::setw(12) << "FLOP/byte" << std::setw(10) << "of roof" << "  bound" << std::endl;
+  RooflineBound dominant = RooflineBound::Transfer;
+  double dominantNs = -1.0;
+  for (const auto& phase : phases)
+  {
+    const double gbs = phase.bytes / phase.ns;
+    const double gflops = phase.flops / phase.ns;
+    RooflineBound bound = RooflineBound::Transfer;
+    double roof = 0.0;
+    double achieved = gbs;
+    if (phase.kind == RooflinePhase::Upload)
+      roof = peaks.uploadGBs;
+    else if (phase.kind == RooflinePhase::ReadBack)
+      roof = peaks.readBackGBs;
+    else
+    {
+      // Below the ridge the memory roof is the lower one
+      const double intensity = phase.bytes > 0.0 ? phase.flops / phase.bytes : 0.0;
+      bound = intensity < ridge ? RooflineBound::Memory : RooflineBound::Compute;
+      roof = bound == RooflineBound::Memory ? intensity * peaks.memoryGBs : peaks.gflops;
+      achieved = gflops;
+      if (bound == RooflineBound::Memory && intensity == 0.0)
+      {
+        roof = peaks.memoryGBs;
+        achieved = gbs;
+      }
+    }
+    std::cout << std::left << std::setw(24) << (std::string(phaseKindName(phase.kind)) + " " + phase.name).substr(0, 23)
+      << std::right << std::setw(12) << phase.ns * 1.e-6 << std::setw(10) << gbs << std::setw(10) << gflops;
+    if (phase.kind == RooflinePhase::Kernel)
+      std::cout << std::setw(12) << (phase.bytes > 0.0 ? phase.flops / phase.bytes : 0.0);
+    else
+      std::cout << std::setw(12) << "-";
+    if (roof > 0.0)
+      std::cout << std::setw(9) << 100.0 * achieved / roof << "%";
+    else
+      std::cout << std::setw(10) << "n/a";
+    std::cout << "  " << rooflineBoundName(bound) << std::endl;
+    if (phase.ns > dominantNs)
+    {
+      dominantNs = phase.ns;
+      dominant = bound;
+    }
+  }
+  std::cout.unsetf(std::ios::floatfield);
+  std::cout << std::setprecision(6);
+  return dominant;
+}
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#include <oclUtils.h>
+
+// Roofline model of a run: every transfer and kernel is placed against the device peaks, which
+// tells whether the next optimization should cut transfers, memory traffic or arithmetic.
+struct DevicePeaks
+{
+  double clockMHz = 0.0;
+  int cores = 0;
+  // Cores per compute unit from ConvertSMVer2Cores (cl_nv_device_attribute_query);
+  // otherwise estimated as CL_DEVICE_NATIVE_VECTOR_WIDTH_FLOAT lanes per compute unit
+  bool coresFromSmVersion = false;
+  // One FMA per core and cycle
+  double gflops = 0.0;
+  // Measured by measureDevicePeaks(), 0 until then
+  double memoryGBs = 0.0;
+  double uploadGBs = 0.0;
+  double readBackGBs = 0.0;
+};
+
+// Compute peak from CL_DEVICE_MAX_COMPUTE_UNITS and CL_DEVICE_MAX_CLOCK_FREQUENCY, no device work
+DevicePeaks theoreticalPeaks(cl_device_id device);
+
+// Theoretical peaks plus the stream-triad bandwidth and the pageable upload and read-back bandwidth,
+// each the best of a few profiled runs over bufferBytes (capped by CL_DEVICE_MAX_MEM_ALLOC_SIZE)
+DevicePeaks measureDevicePeaks(cl_context context, cl_device_id device, size_t bufferBytes);
+
+enum class RooflineBound
+{
+  Transfer,
+  Memory,
+  Compute
+};
+
+struct RooflinePhase
+{
+  enum Kind
+  {
+    Upload,
+    Kernel,
+    ReadBack
+  };
+  std::string name;
+  Kind kind;
+  double bytes;  // host-device bytes of a transfer, compulsory global memory traffic of a kernel
+  double flops;  // kernels only
+  double ns;     // device time
+};
+
+// Prints achieved GB/s and GFLOP/s of every phase against its roof and its bound;
+// returns the bound of the phase that takes the most device time
+RooflineBound reportRoofline(const DevicePeaks& peaks, const std::vector<RooflinePhase>& phases);
+
+const char* rooflineBoundName(RooflineBound bound);
@@ -0,0 +1,186 @@
+#include "threadPool.h"
+
+#include <algorithm>
+#include <exception>
+
+namespace
+{
+  // Index of the pool worker running on this thread, NO_WORKER for foreign threads
+  const size_t NO_WORKER = size_t(-1);
+  thread_local size_t currentWorker = NO_WORKER;
+  thread_local const void* currentPool = nullptr;
+}
+
+ThreadPool::ThreadPool(size_t numThreads)
+{
+  numThreads = std::max<size_t>(numThreads, 1);
+  for (size_t i = 0; i < numThreads; ++i)
+  {
+    workers_.push_back(std::make_unique<Worker>());
+  }
+  for (size_t i = 0; i < numThreads; ++i)
+  {
+    threads_.emplace_back(&ThreadPool::workerLoop, this, i);
+  }
+}
+
+ThreadPool::~ThreadPool()
+{
+  {
+    std::lock_guard<std::mutex> lock(wakeMutex_);
+    stop_ = true;
+  }
+  wake_.notify_all();
+  for (auto& thread : threads_)
+  {
+    thread.join();
+  }
+}
+
+ThreadPool& ThreadPool::instance()
+{
+  static ThreadPool pool;
+  return pool;
+}
+
+std::future<void> ThreadPool::submit(std::function<void()> task)
+{
+  auto packagedTask = std::make_shared<std::packaged_task<void()>>(std::move(task));
+  auto future = packagedTask->get_future();
+  push([packagedTask]() { (*packagedTask)(); });
+  return future;
+}
+
+void ThreadPool::parallelFor(size_t begin, size_t end, const std::function<void(size_t, size_t)>& body,
+  size_t numChunks)
+{
+  if (end <= begin)
+    return;
+
+  const size_t count = end - begin;
+  if (numChunks == 0)
+    numChunks = 4 * size();
+  numChunks = std::min(numChunks, count);
+
+  // Lives on this frame: parallelFor only returns once every chunk has finished with it
+  struct State
+  {
+    std::mutex mutex;
+    std::condition_variable done;
+    size_t remaining;
+    std::exception_ptr error;
+  } state;
+  state.remaining = numChunks;
+
+  for (size_t chunk = 0; chunk < numChunks; ++chunk)
+  {
+    const size_t chunkBegin = begin + count * chunk / numChunks;
+    const size_t chunkEnd = begin + count * (chunk + 1) / numChunks;
+    push([&body, &state, chunkBegin, chunkEnd]()
+    {
+      // A throwing chunk still counts as done; the first exception is rethrown by parallelFor
+      std::exception_ptr error;
+      try
+      {
+        body(chunkBegin, chunkEnd);
+      }
+      catch (...)
+      {
+        error = std::current_exception();
+      }
+      std::lock_guard<std::mutex> lock(state.mutex);
+      if (error && !state.error)
+        state.error = error;
+      if (--state.remaining == 0)
+        state.done.notify_all();
+    });
+  }
+
+  // Help instead of blocking, so nested parallelFor calls from a worker cannot deadlock;
+  // once nothing is left to steal, sleep until the chunks running elsewhere finish
+  while (true)
+  {
+    {
+      std::lock_guard<std::mutex> lock(state.mutex);
+      if (state.remaining == 0)
+        break;
+    }
+    if (runPendingTask())
+      continue;
+    std::unique_lock<std::mutex> lock(state.mutex);
+    state.done.wait(lock, [&state]() { return state.remaining == 0; });
+  }
+  if (state.error)
+    std::rethrow_exception(state.error);
+}
+
+void ThreadPool::push(Task task)
+{
+  const size_t target = (currentPool == this) ? currentWorker : nextWorker_++ % workers_.size();
+  // Counted before it is published: a thief decrements right after taking it, and pending_ must not wrap
+  {
+    std::lock_guard<std::mutex> lock(wakeMutex_);
+    pending_++;
+  }
+  {
+    std::lock_guard<std::mutex> lock(workers_[target]->mutex);
+    workers_[target]->tasks.push_back(std::move(task));
+  }
+  wake_.notify_one();
+}
+
+bool ThreadPool::popLocal(size_t workerIdx, Task& task)
+{
+  auto& worker = *workers_[workerIdx];
+  std::lock_guard<std::mutex> lock(worker.mutex);
+  if (worker.tasks.empty())
+    return false;
+  task = std::move(worker.tasks.back());
+  worker.tasks.pop_back();
+  return true;
+}
+
+bool ThreadPool::steal(size_t thiefIdx, Task& task)
+{
+  const size_t numWorkers = workers_.size();
+  for (size_t offset = 1; offset <= numWorkers; ++offset)
+  {
+    auto& victim = *workers_[(thiefIdx + offset) % numWorkers];
+    std::lock_guard<std::mutex> lock(victim.mutex);
+    if (victim.tasks.empty())
+      continue;
+    task = std::move(victim.tasks.front());
+    victim.tasks.pop_front();
+    return true;
+  }
+  return false;
+}
+
+bool ThreadPool::runPendingTask()
+{
+  Task task;
+  const bool isWorker = (currentPool == this);
+  const size_t self = isWorker ? currentWorker : nextWorker_.load() % workers_.size();
+  if (!(isWorker && popLocal(self, task)) && !steal(self, task))
+    return false;
+
+  pending_--;
+  task();
+  return true;
+}
+
+void ThreadPool::workerLoop(size_t workerIdx)
+{
+  currentWorker = workerIdx;
+  currentPool = this;
+  while (true)
+  {
+    if (runPendingTask())
+      continue;
+
+    std::unique_lock<std::mutex> lock(wakeMutex_);
+    wake_.wait(lock, [this]() { return stop_ || pending_ > 0; });
+    if (stop_ && pending_ == 0)
+      return;
+  }
+}
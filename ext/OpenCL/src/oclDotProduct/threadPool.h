@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Long-lived work-stealing pool for the host-side loops.
+// Every worker owns a deque: it pops its own tasks from the back and steals
+// from the front of the other deques when it runs dry.
+class ThreadPool
+{
+public:
+  explicit ThreadPool(size_t numThreads = std::thread::hardware_concurrency());
+  ~ThreadPool();
+  ThreadPool(const ThreadPool&) = delete;
+  ThreadPool& operator=(const ThreadPool&) = delete;
+
+  // Process-wide pool sized from the hardware concurrency
+  static ThreadPool& instance();
+
+  size_t size() const { return threads_.size(); }
+
+  std::future<void> submit(std::function<void()> task);
+
+  // Splits [begin, end) into numChunks ranges (4 per worker by default) and runs
+  // body(chunkBegin, chunkEnd) on the pool. The calling thread helps until all chunks are done;
+  // the first exception thrown by body is rethrown here after every chunk has finished.
+  void parallelFor(size_t begin, size_t end, const std::function<void(size_t, size_t)>& body,
+    size_t numChunks = 0);
+
+private:
+  using Task = std::function<void()>;
+  struct Worker
+  {
+    std::mutex mutex;
+    std::deque<Task> tasks;
+  };
+
+  void push(Task task);
+  bool popLocal(size_t workerIdx, Task& task);
+  bool steal(size_t thiefIdx, Task& task);
+  bool runPendingTask();
+  void workerLoop(size_t workerIdx);
+
+  std::vector<std::unique_ptr<Worker>> workers_;
+  std::vector<std::thread> threads_;
+  std::mutex wakeMutex_;
+  std::condition_variable wake_;
+  std::atomic<size_t> pending_{ 0 };
+  std::atomic<size_t> nextWorker_{ 0 };
+  std::atomic<bool> stop_{ false };
+};
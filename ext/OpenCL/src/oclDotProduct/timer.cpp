@@ -1,15 +1,346 @@
 ﻿#include "timer.h"
+
+#ifndef TIMER_DISABLED
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <vector>
+
+#include "eventProfiler.h"
+#include "perfCounters.h"
+#include "traceExporter.h"
+
+namespace
+{
+  const size_t NO_PARENT = size_t(-1);
+
+  struct Record
+  {
+    std::string label;
+    std::string outerPath;  // path of ancestors already reported and dropped from the buffer
+    uint64_t id = 0;
+    size_t parent = NO_PARENT;
+    int64_t begin = 0;
+    int64_t end = -1;  // -1 while the scope is open
+    // Profiled commands enqueued during the scope, [profileBegin, profileEnd) in EventProfiler
+    size_t profileBegin = 0;
+    size_t profileEnd = 0;
+  };
+}
+
+// Owned by the registry so the records outlive their thread; the mutex is only contended during a report.
+// A report takes the finished records out, so the buffer only holds the scopes since the last one;
+// records stay sorted by id and a Timer finds its own by id.
+struct TimerBuffer
+{
+  std::mutex mutex;
+  std::vector<Record> records;
+  std::vector<size_t> open;
+  uint64_t nextId = 0;
+
+  size_t find(uint64_t id) const
+  {
+    return std::lower_bound(records.begin(), records.end(), id, [](const Record& record, uint64_t x) { return record.id < x; })
+      - records.begin();
+  }
+};
+
+namespace
+{
+  class TimerRegistry
+  {
+  public:
+    static TimerRegistry& instance()
+    {
+      static TimerRegistry registry;
+      return registry;
+    }
+
+    // Constructed first so that they are destroyed last: the hardware counters print after the scopes at exit,
+    // and the report at exit can still collect profiled commands into the trace
+    TimerRegistry()
+    {
+      PerfCounters::instance();
+      EventProfiler::instance();
+      TraceExporter::instance();
+    }
+
+    ~TimerRegistry()
+    {
+      report();
+    }
+
+    TimerBuffer* threadBuffer()
+    {
+      thread_local TimerBuffer* buffer = nullptr;
+      if (!buffer)
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        buffers_.push_back(std::make_unique<TimerBuffer>());
+        buffer = buffers_.back().get();
+        buffer->records.reserve(256);
+      }
+      return buffer;
+    }
+
+    void report();
+
+  private:
+    // Profiled commands of one label within a scope, summed over its calls
+    struct DeviceCommand
+    {
+      const char* kind = "";
+      size_t count = 0;
+      double queuedToSubmitNs = 0;
+      double submitToStartNs = 0;
+      double startToEndNs = 0;
+    };
+
+    struct Node
+    {
+      std::string label;
+      int64_t firstBegin = 0;
+      std::vector<int64_t> durations;
+      std::vector<std::string> children;
+      std::map<std::string, DeviceCommand> commands;
+      double kernelNs = 0;
+      double transferNs = 0;
+      double busyNs = 0;
+      double overheadNs = 0;  // wall time of the profiled calls not covered by device work
+    };
+
+    std::mutex mutex_;
+    std::vector<std::unique_ptr<TimerBuffer>> buffers_;
+  };
+
+  // Scope path "outer/inner" of a record, from its thread's parent chain
+  std::string scopePath(const std::vector<Record>& records, size_t index)
+  {
+    std::string path = records[index].label;
+    for (; records[index].parent != NO_PARENT; index = records[index].parent)
+      path = records[records[index].parent].label + "/" + path;
+    return records[index].outerPath.empty() ? path : records[index].outerPath + "/" + path;
+  }
+
+  double percentileMs(const std::vector<int64_t>& sorted, double fraction)
+  {
+    const size_t index = std::min(sorted.size() - 1, (size_t)(fraction * (sorted.size() - 1) + 0.5));
+    return sorted[index] * 1.e-6;
+  }
+
+  void TimerRegistry::report()
+  {
+    struct Finished
+    {
+      std::string path;
+      Record record;
+    };
+    std::vector<Finished> finished;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      for (const auto& buffer : buffers_)
+      {
+        std::lock_guard<std::mutex> bufferLock(buffer->mutex);
+        auto& records = buffer->records;
+        // Finished records move into the report; the open ones are compacted to the front with their
+        // parent links re-indexed, and a reported parent becomes the path prefix of its children
+        std::vector<std::string> paths(records.size());
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+          const size_t parent = records[i].parent;
+          if (records[i].end >= 0)
+            paths[i] = scopePath(records, i);
+          else if (parent != NO_PARENT && records[parent].end >= 0)
+            paths[i] = scopePath(records, parent);
+        }
+        size_t kept = 0;
+        std::vector<size_t> newIndex(records.size(), NO_PARENT);
+        for (size_t i = 0; i < records.size(); ++i)
+        {
+          if (records[i].end >= 0)
+          {
+            finished.push_back({ std::move(paths[i]), std::move(records[i]) });
+            continue;
+          }
+          auto& record = records[i];
+          if (record.parent != NO_PARENT)
+          {
+            if (newIndex[record.parent] == NO_PARENT)
+            {
+              record.outerPath = std::move(paths[i]);
+              record.parent = NO_PARENT;
+            }
+            else
+              record.parent = newIndex[record.parent];
+          }
+          newIndex[i] = kept;
+          if (kept != i)
+            records[kept] = std::move(record);
+          ++kept;
+        }
+        records.resize(kept);
+        for (auto& index : buffer->open)
+          index = newIndex[index];
+      }
+    }
+    if (finished.empty())
+      return;
+
+    // Inner scopes end first and claim their commands before the scopes around them
+    std::sort(finished.begin(), finished.end(), [](const Finished& x, const Finished& y)
+    {
+      return x.record.end != y.record.end ? x.record.end < y.record.end : x.record.begin > y.record.begin;
+    });
+    std::map<std::string, Node> nodes;
+    for (const auto& scope : finished)
+    {
+      const auto& record = scope.record;
+      auto inserted = nodes.emplace(scope.path, Node());
+      auto& node = inserted.first->second;
+      if (inserted.second)
+        node.firstBegin = record.begin;
+      node.firstBegin = std::min(node.firstBegin, record.begin);
+      node.durations.push_back(record.end - record.begin);
+      if (record.profileEnd <= record.profileBegin)
+        continue;
+
+      const auto commands = EventProfiler::instance().collect(record.profileBegin, record.profileEnd);
+      if (commands.empty())
+        continue;
+      for (const auto& command : commands)
+      {
+        auto& summary = node.commands[command.label];
+        summary.kind = command.kind;
+        summary.count++;
+        summary.queuedToSubmitNs += command.submit - command.queued;
+        summary.submitToStartNs += command.start - command.submit;
+        summary.startToEndNs += command.end - command.start;
+      }
+      const auto busy = EventProfiler::busyTime(commands);
+      node.kernelNs += busy.kernel;
+      node.transferNs += busy.transfer;
+      node.busyNs += busy.all;
+      node.overheadNs += std::max<double>(0.0, (double)(record.end - record.begin) - busy.all);
+    }
+
+    // Scopes whose parent is still open or was reported before are printed as roots, under their full path
+    std::vector<std::string> roots;
+    for (auto& entry : nodes)
+    {
+      const size_t slash = entry.first.rfind('/');
+      auto parent = slash == std::string::npos ? nodes.end() : nodes.find(entry.first.substr(0, slash));
+      if (parent == nodes.end())
+      {
+        entry.second.label = entry.first;
+        roots.push_back(entry.first);
+      }
+      else
+      {
+        entry.second.label = entry.first.substr(slash + 1);
+        parent->second.children.push_back(entry.first);
+      }
+    }
+    auto byStart = [&nodes](const std::string& x, const std::string& y) { return nodes[x].firstBegin < nodes[y].firstBegin; };
+
+    std::ostringstream out;
+    out << std::left << std::setw(66) << "Timer scopes, ms" << std::right << std::setw(6) << "count" << std::setw(12) << "total"
+      << std::setw(11) << "min" << std::setw(11) << "median" << std::setw(11) << "p99" << "\n" << std::fixed << std::setprecision(3);
+    std::function<void(const std::string&, int)> print = [&](const std::string& path, int depth)
+    {
+      auto& node = nodes[path];
+      std::sort(node.durations.begin(), node.durations.end());
+      int64_t total = 0;
+      for (auto duration : node.durations)
+        total += duration;
+      const std::string name = std::string(2 * depth, ' ') + node.label;
+      out << "  " << std::left << std::setw(64) << name.substr(0, 63) << std::right << std::setw(6) << node.durations.size()
+        << std::setw(12) << total * 1.e-6 << std::setw(11) << percentileMs(node.durations, 0.0)
+        << std::setw(11) << percentileMs(node.durations, 0.5) << std::setw(11) << percentileMs(node.durations, 0.99) << "\n";
+      // Device breakdown of the profiled calls, totals in ms
+      const std::string indent(2 * depth + 4, ' ');
+      for (const auto& entry : node.commands)
+      {
+        const auto& command = entry.second;
+        out << indent << std::left << std::setw(28) << entry.first << std::setw(10) << command.kind << std::right
+          << " x" << command.count << ": queued->submit " << command.queuedToSubmitNs * 1.e-6
+          << ", submit->start " << command.submitToStartNs * 1.e-6 << ", start->end " << command.startToEndNs * 1.e-6 << "\n";
+      }
+      if (!node.commands.empty())
+      {
+        out << indent << "device kernel " << node.kernelNs * 1.e-6 << " ms, transfer " << node.transferNs * 1.e-6
+          << " ms, busy " << node.busyNs * 1.e-6 << " ms; host overhead " << node.overheadNs * 1.e-6 << " ms\n";
+      }
+      std::sort(node.children.begin(), node.children.end(), byStart);
+      for (const auto& child : node.children)
+        print(child, depth + 1);
+    };
+    std::sort(roots.begin(), roots.end(), byStart);
+    for (const auto& root : roots)
+      print(root, 0);
+    std::cout << out.str() << std::flush;
+  }
+}
+
+int64_t Timer::now()
+{
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
 
 Timer::Timer(std::string msg)
 {
-  msg_ = msg;
-  begin_ = std::chrono::steady_clock::now();
+  buffer_ = TimerRegistry::instance().threadBuffer();
+  profiled_ = EventProfiler::instance().enabled();
+  const size_t profileMark = profiled_ ? EventProfiler::instance().beginScope() : 0;
+  {
+    std::lock_guard<std::mutex> lock(buffer_->mutex);
+    id_ = buffer_->nextId++;
+    buffer_->records.emplace_back();
+    auto& record = buffer_->records.back();
+    record.label = std::move(msg);
+    record.id = id_;
+    record.parent = buffer_->open.empty() ? NO_PARENT : buffer_->open.back();
+    record.profileBegin = profileMark;
+    buffer_->open.push_back(buffer_->records.size() - 1);
+    record.begin = now();
+  }
 }
 
 Timer::~Timer()
 {
-  end_ = std::chrono::steady_clock::now();
-  auto ms = std::chrono::duration_cast<std::chrono::milliseconds>(end_ - begin_).count();
-  std::cout << "        TIME elapsed for " << msg_ << ": " << ms << "ms @@@" << std::endl;
+  const int64_t end = now();
+  const size_t profileMark = profiled_ ? EventProfiler::instance().endScope() : 0;
+  std::string label;
+  int64_t begin = 0;
+  {
+    std::lock_guard<std::mutex> lock(buffer_->mutex);
+    // A report may have compacted the buffer since the scope opened
+    const size_t index = buffer_->find(id_);
+    auto& record = buffer_->records[index];
+    record.end = end;
+    record.profileEnd = profileMark;
+    begin = record.begin;
+    // Scopes held in unique_ptrs may close out of order
+    auto& open = buffer_->open;
+    auto it = std::find(open.rbegin(), open.rend(), index);
+    if (it != open.rend())
+      open.erase(std::next(it).base());
+    if (TraceExporter::instance().enabled())
+      label = record.label;
+  }
+  TraceExporter::instance().addHostSpan(label, "scope", begin, end);
 }
+
+void Timer::report()
+{
+  TimerRegistry::instance().report();
+  PerfCounters::instance().report();
+}
+
+#endif
@@ -1,16 +1,51 @@
 #pragma once
 
 #include <chrono>
+#include <cstdint>
 #include <string>
 
+// Nestable scope timer. A Timer records its label and steady-clock begin/end in nanoseconds into a
+// buffer owned by the current thread, under the scope that was open on that thread when it started.
+// Nothing is printed per scope: Timer::report() prints count, total, min, median and p99 per scope path
+// (parent/child) over all threads, and runs by itself at exit for anything not reported yet.
+// With event profiling on (see eventProfiler.h) the report also breaks every scope down into the commands
+// enqueued inside it.
+// Define TIMER_DISABLED to compile the scopes out entirely.
+#ifndef TIMER_DISABLED
+
 class Timer
 {
 public:
   Timer(std::string msg);
   ~Timer();
+  Timer(const Timer&) = delete;
+  Timer& operator=(const Timer&) = delete;
+
+  // Aggregates the scopes finished since the last report and prints them as a tree,
+  // followed by the hardware counters of the same period (see perfCounters.h)
+  static void report();
+
+  // Nanoseconds on the steady clock the scopes are recorded with
+  static int64_t now();
+
 private:
-  std::chrono::steady_clock::time_point begin_;
-  std::chrono::steady_clock::time_point end_;
-  std::string msg_;
+  struct TimerBuffer* buffer_;
+  uint64_t id_;
+  bool profiled_;
+};
+
+#else
+
+class Timer
+{
+public:
+  template <class T>
+  Timer(const T&) {}
+  static void report() {}
+  static int64_t now()
+  {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+  }
 };
 
+#endif
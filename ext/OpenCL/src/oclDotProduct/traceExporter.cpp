@@ -0,0 +1,196 @@
+#include "traceExporter.h"
+
+#include <algorithm>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include "timer.h"
+
+namespace
+{
+  const int HOST_PID = 1;
+  const int CALIBRATION_SAMPLES = 16;
+
+  std::string jsonString(const std::string& text)
+  {
+    std::string quoted = "\"";
+    for (char c : text)
+    {
+      if (c == '"' || c == '\\')
+        quoted += '\\';
+      if ((unsigned char)c >= 0x20)
+        quoted += c;
+    }
+    return quoted + "\"";
+  }
+}
+
+TraceExporter& TraceExporter::instance()
+{
+  static TraceExporter exporter;
+  return exporter;
+}
+
+void TraceExporter::enable(const std::string& fileName)
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  fileName_ = fileName;
+  enabled_ = true;
+}
+
+int TraceExporter::hostThread()
+{
+  auto inserted = threads_.emplace(std::this_thread::get_id(), (int)threads_.size());
+  return inserted.first->second;
+}
+
+void TraceExporter::addHostSpan(const std::string& name, const char* category, int64_t begin, int64_t end)
+{
+  if (!enabled_)
+    return;
+  std::lock_guard<std::mutex> lock(mutex_);
+  events_.push_back({ name, category, HOST_PID, hostThread(), begin, end, std::string() });
+}
+
+void TraceExporter::calibrate(cl_context context, cl_device_id device)
+{
+  if (!enabled_)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (devices_.count(device))
+      return;
+  }
+
+  // Measured without the lock, on a queue of its own, so no traced span or profiled command waits for it
+  Calibration calibration;
+  char name[256] = {};
+  clGetDeviceInfo(device, CL_DEVICE_NAME, sizeof(name) - 1, name, nullptr);
+  calibration.name = name;
+  size_t resolution = 0;
+  clGetDeviceInfo(device, CL_DEVICE_PROFILING_TIMER_RESOLUTION, sizeof(resolution), &resolution, nullptr);
+  calibration.resolutionNs = resolution;
+
+  cl_command_queue queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, nullptr);
+  cl_mem probe = clCreateBuffer(context, CL_MEM_READ_WRITE, sizeof(cl_int), nullptr, nullptr);
+  cl_int value = 0;
+  int64_t bestWindow = -1;
+  for (int i = 0; i < CALIBRATION_SAMPLES && queue && probe; ++i)
+  {
+    cl_event event = 0;
+    const int64_t hostBefore = Timer::now();
+    const cl_int status = clEnqueueWriteBuffer(queue, probe, CL_TRUE, 0, sizeof(value), &value, 0, nullptr, &event);
+    const int64_t hostAfter = Timer::now();
+    if (status != CL_SUCCESS)
+      break;
+    cl_ulong start = 0, end = 0;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+    clReleaseEvent(event);
+    // The command ran somewhere inside the host bracket; align the midpoints
+    if (bestWindow < 0 || hostAfter - hostBefore < bestWindow)
+    {
+      bestWindow = hostAfter - hostBefore;
+      calibration.offset = (hostBefore + hostAfter) / 2 - (int64_t)((start + end) / 2);
+    }
+  }
+  if (probe)
+    clReleaseMemObject(probe);
+  if (queue)
+    clReleaseCommandQueue(queue);
+  calibration.aligned = bestWindow >= 0;
+  calibration.errorNs = std::max<int64_t>(bestWindow, 0) / 2.0 + resolution;
+  if (calibration.aligned)
+    std::cout << "Trace clock alignment for " << calibration.name << ": +-" << calibration.errorNs * 1.e-3 << " us" << std::endl;
+  else
+    std::cout << "Trace clock alignment for " << calibration.name << " failed, its commands keep the device clock" << std::endl;
+
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (devices_.count(device))
+    return;
+  calibration.pid = HOST_PID + 1 + (int)devices_.size();
+  devices_.emplace(device, calibration);
+}
+
+void TraceExporter::addDeviceCommand(cl_command_queue queue, const std::string& name, const char* category,
+  cl_ulong queued, cl_ulong submit, cl_ulong start, cl_ulong end)
+{
+  if (!enabled_)
+    return;
+  cl_device_id deviceId = 0;
+  clGetCommandQueueInfo(queue, CL_QUEUE_DEVICE, sizeof(deviceId), &deviceId, nullptr);
+  std::lock_guard<std::mutex> lock(mutex_);
+  auto found = devices_.find(deviceId);
+  if (found == devices_.end())
+  {
+    // A device nobody calibrated is traced unaligned rather than probed in the middle of the run
+    Calibration calibration;
+    calibration.pid = HOST_PID + 1 + (int)devices_.size();
+    char deviceName[256] = {};
+    clGetDeviceInfo(deviceId, CL_DEVICE_NAME, sizeof(deviceName) - 1, deviceName, nullptr);
+    calibration.name = deviceName;
+    found = devices_.emplace(deviceId, calibration).first;
+  }
+  const auto& device = found->second;
+  const auto track = queues_.emplace(queue, std::make_pair(device.pid, (int)queues_.size())).first->second;
+  std::ostringstream args;
+  args << "{\"queued->submit us\": " << (submit - queued) * 1.e-3 << ", \"submit->start us\": " << (start - submit) * 1.e-3 << "}";
+  events_.push_back({ name, category, track.first, track.second, (int64_t)start + device.offset, (int64_t)end + device.offset, args.str() });
+}
+
+bool TraceExporter::write()
+{
+  std::lock_guard<std::mutex> lock(mutex_);
+  if (!enabled_ || events_.empty())
+    return false;
+  std::ofstream file(fileName_);
+  if (!file)
+  {
+    std::cout << "Cannot write the trace to " << fileName_ << std::endl;
+    return false;
+  }
+
+  int64_t origin = events_.front().begin;
+  for (const auto& event : events_)
+    origin = std::min(origin, event.begin);
+
+  file << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n";
+  file << "{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": " << HOST_PID << ", \"args\": {\"name\": \"host\"}}";
+  for (const auto& thread : threads_)
+  {
+    file << ",\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": " << HOST_PID << ", \"tid\": " << thread.second
+      << ", \"args\": {\"name\": \"thread " << thread.second << "\"}}";
+  }
+  for (const auto& device : devices_)
+  {
+    file << ",\n{\"ph\": \"M\", \"name\": \"process_name\", \"pid\": " << device.second.pid << ", \"args\": {\"name\": "
+      << jsonString("device " + device.second.name) << ", \"clock aligned\": " << (device.second.aligned ? "true" : "false")
+      << ", \"clock alignment error us\": " << device.second.errorNs * 1.e-3
+      << ", \"timer resolution ns\": " << device.second.resolutionNs << "}}";
+  }
+  for (const auto& queue : queues_)
+  {
+    file << ",\n{\"ph\": \"M\", \"name\": \"thread_name\", \"pid\": " << queue.second.first << ", \"tid\": " << queue.second.second
+      << ", \"args\": {\"name\": \"queue " << queue.second.second << "\"}}";
+  }
+  for (const auto& event : events_)
+  {
+    file << ",\n{\"ph\": \"X\", \"name\": " << jsonString(event.name) << ", \"cat\": \"" << event.category
+      << "\", \"pid\": " << event.pid << ", \"tid\": " << event.tid << ", \"ts\": " << (event.begin - origin) * 1.e-3
+      << ", \"dur\": " << std::max<int64_t>(event.end - event.begin, 0) * 1.e-3;
+    if (!event.args.empty())
+      file << ", \"args\": " << event.args;
+    file << "}";
+  }
+  file << "\n]}\n";
+  std::cout << "Trace of " << events_.size() << " events written to " << fileName_ << std::endl;
+  events_.clear();
+  return true;
+}
+
+TraceExporter::~TraceExporter()
+{
+  write();
+}
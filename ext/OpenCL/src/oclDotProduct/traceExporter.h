@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <oclUtils.h>
+
+// Chrome trace-event (chrome://tracing, Perfetto) export of one run on a single timeline:
+// the host Timer scopes and HeavyCalculationCPU chunks per thread, and the profiled OpenCL commands
+// per queue. Device timestamps are moved onto the host steady clock with an offset measured once per device
+// by calibrate(), before the run: a few blocking 4-byte writes are bracketed by host timestamps and the
+// tightest bracket wins; its half-width plus CL_DEVICE_PROFILING_TIMER_RESOLUTION is the alignment error
+// stored with the trace.
+// Device commands reach the trace through EventProfiler::collect, so tracing turns event profiling on.
+class TraceExporter
+{
+public:
+  static TraceExporter& instance();
+
+  // Starts collecting; the trace is written to fileName at exit or by write()
+  void enable(const std::string& fileName);
+  bool enabled() const { return enabled_; }
+
+  // Measures the clock offset of the device on a private queue; once per device, no-op when disabled
+  void calibrate(cl_context context, cl_device_id device);
+
+  // Span on the calling thread, steady-clock nanoseconds (Timer::now())
+  void addHostSpan(const std::string& name, const char* category, int64_t begin, int64_t end);
+  // Profiled command of the queue, device nanoseconds as returned by clGetEventProfilingInfo;
+  // a device that was not calibrated keeps its own clock
+  void addDeviceCommand(cl_command_queue queue, const std::string& name, const char* category,
+    cl_ulong queued, cl_ulong submit, cl_ulong start, cl_ulong end);
+
+  bool write();
+  ~TraceExporter();
+
+private:
+  struct Event
+  {
+    std::string name;
+    const char* category;
+    int pid;
+    int tid;
+    int64_t begin;  // host steady-clock ns
+    int64_t end;
+    std::string args;
+  };
+  struct Calibration
+  {
+    bool aligned = false;
+    int64_t offset = 0;  // host ns - device ns
+    double errorNs = 0;
+    cl_ulong resolutionNs = 0;
+    int pid = 0;
+    std::string name;
+  };
+
+  TraceExporter() = default;
+  int hostThread();
+
+  bool enabled_ = false;
+  std::string fileName_;
+  std::mutex mutex_;
+  std::vector<Event> events_;
+  std::map<std::thread::id, int> threads_;
+  std::map<cl_device_id, Calibration> devices_;
+  // Trace process and thread of every queue seen
+  std::map<cl_command_queue, std::pair<int, int>> queues_;
+};
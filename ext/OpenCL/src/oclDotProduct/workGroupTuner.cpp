@@ -0,0 +1,170 @@
+#include "workGroupTuner.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <sstream>
+#include <thread>
+#include <vector>
+
+namespace
+{
+  std::string deviceString(cl_device_id device, cl_device_info param)
+  {
+    size_t size = 0;
+    clGetDeviceInfo(device, param, 0, nullptr, &size);
+    std::string value(size, '\0');
+    clGetDeviceInfo(device, param, size, &value[0], nullptr);
+    value = value.c_str();
+    // Tabs and newlines separate the database fields
+    std::replace(value.begin(), value.end(), '\t', ' ');
+    std::replace(value.begin(), value.end(), '\n', ' ');
+    return value;
+  }
+
+  // Kernel time in ns of one launch, or 0 when the launch failed
+  cl_ulong timeLaunch(cl_command_queue queue, cl_kernel kernel, size_t globalWorkSize, size_t localWorkSize)
+  {
+    cl_event event = 0;
+    const cl_int status = clEnqueueNDRangeKernel(queue, kernel, 1, nullptr, &globalWorkSize,
+      localWorkSize ? &localWorkSize : nullptr, 0, nullptr, &event);
+    if (status != CL_SUCCESS)
+      return 0;
+    clWaitForEvents(1, &event);
+    cl_ulong start = 0, end = 0;
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_START, sizeof(start), &start, nullptr);
+    clGetEventProfilingInfo(event, CL_PROFILING_COMMAND_END, sizeof(end), &end, nullptr);
+    clReleaseEvent(event);
+    return std::max<cl_ulong>(end - start, 1);
+  }
+}
+
+WorkGroupTuner::WorkGroupTuner(std::string databasePath) :
+  databasePath_(std::move(databasePath))
+{
+  std::ifstream file(databasePath_);
+  std::string line;
+  while (std::getline(file, line))
+  {
+    const auto lastTab = line.rfind('\t');
+    if (lastTab == std::string::npos || line.find('\t') == lastTab)
+      continue;
+    try
+    {
+      entries_[line.substr(0, lastTab)] = (size_t)std::stoull(line.substr(lastTab + 1));
+    }
+    catch (const std::exception&)
+    {
+      std::cout << "Ignoring malformed tuning entry: " << line << std::endl;
+    }
+  }
+}
+
+std::string WorkGroupTuner::defaultDatabasePath()
+{
+  const char* path = getenv("OCL_TUNING_DB");
+  return (path && *path) ? path : "oclWorkGroupTuning.txt";
+}
+
+std::string WorkGroupTuner::deviceKey(cl_device_id device)
+{
+  return deviceString(device, CL_DEVICE_NAME) + " / " + deviceString(device, CL_DRIVER_VERSION);
+}
+
+bool WorkGroupTuner::lookup(cl_device_id device, const std::string& kernelName, size_t& localWorkSize) const
+{
+  auto entry = entries_.find(deviceKey(device) + "\t" + kernelName);
+  if (entry == entries_.end())
+    return false;
+  localWorkSize = entry->second;
+  return true;
+}
+
+size_t WorkGroupTuner::tune(cl_context context, cl_device_id device, cl_kernel kernel, const std::string& kernelName,
+  size_t globalWorkSize, int repetitions)
+{
+  size_t deviceMax = 0, kernelMax = 0, preferredMultiple = 1;
+  clGetDeviceInfo(device, CL_DEVICE_MAX_WORK_GROUP_SIZE, sizeof(deviceMax), &deviceMax, nullptr);
+  clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_WORK_GROUP_SIZE, sizeof(kernelMax), &kernelMax, nullptr);
+  clGetKernelWorkGroupInfo(kernel, device, CL_KERNEL_PREFERRED_WORK_GROUP_SIZE_MULTIPLE,
+    sizeof(preferredMultiple), &preferredMultiple, nullptr);
+  const size_t limit = std::min(deviceMax, kernelMax ? kernelMax : deviceMax);
+  preferredMultiple = std::max<size_t>(preferredMultiple, 1);
+
+  // Multiples of the preferred multiple and powers of two; OpenCL 1.x needs them to divide the global size
+  std::vector<size_t> candidates = { 0 };
+  for (size_t size = preferredMultiple; size <= limit; size += preferredMultiple)
+  {
+    if (globalWorkSize % size == 0)
+      candidates.push_back(size);
+  }
+  for (size_t size = 1; size <= limit; size *= 2)
+  {
+    if (globalWorkSize % size == 0 && std::find(candidates.begin(), candidates.end(), size) == candidates.end())
+      candidates.push_back(size);
+  }
+
+  cl_command_queue queue = clCreateCommandQueue(context, device, CL_QUEUE_PROFILING_ENABLE, nullptr);
+  std::cout << "Autotuning " << kernelName << " over " << candidates.size() << " local work sizes..." << std::endl;
+  size_t best = 0;
+  cl_ulong bestTime = 0;
+  for (auto localWorkSize : candidates)
+  {
+    if (timeLaunch(queue, kernel, globalWorkSize, localWorkSize) == 0) // warmup, also rejects illegal sizes
+      continue;
+    cl_ulong time = 0;
+    for (int rep = 0; rep < repetitions; ++rep)
+    {
+      const cl_ulong repTime = timeLaunch(queue, kernel, globalWorkSize, localWorkSize);
+      time = (rep == 0) ? repTime : std::min(time, repTime);
+    }
+    std::cout << "  local " << (localWorkSize ? std::to_string(localWorkSize) : std::string("NULL"))
+      << ": " << time * 1.e-3 << " us" << std::endl;
+    if (time > 0 && (bestTime == 0 || time < bestTime))
+    {
+      best = localWorkSize;
+      bestTime = time;
+    }
+  }
+  clReleaseCommandQueue(queue);
+
+  std::cout << "Best local work size for " << kernelName << ": " << (best ? std::to_string(best) : std::string("NULL")) << std::endl;
+  entries_[deviceKey(device) + "\t" + kernelName] = best;
+  return best;
+}
+
+void WorkGroupTuner::save() const
+{
+  // Written to a uniquely named file next to the database and renamed over it, so a failed write
+  // leaves the old database intact and concurrent processes never share a temporary file
+  std::ostringstream tmpPath;
+  tmpPath << databasePath_ << "." << std::hash<std::thread::id>()(std::this_thread::get_id()) << "."
+    << std::chrono::steady_clock::now().time_since_epoch().count() << "." << std::random_device()() << ".tmp";
+  {
+    std::ofstream file(tmpPath.str(), std::ios::trunc);
+    for (const auto& entry : entries_)
+    {
+      file << entry.first << "\t" << entry.second << "\n";
+    }
+    file.close();
+    if (!file)
+    {
+      std::cout << "Tuning database: could not write " << tmpPath.str() << std::endl;
+      std::remove(tmpPath.str().c_str());
+      return;
+    }
+  }
+#ifdef _WIN32
+  const bool renamed = MoveFileExA(tmpPath.str().c_str(), databasePath_.c_str(), MOVEFILE_REPLACE_EXISTING) != 0;
+#else
+  const bool renamed = std::rename(tmpPath.str().c_str(), databasePath_.c_str()) == 0;  // replaces atomically
+#endif
+  if (!renamed)
+  {
+    std::cout << "Tuning database: could not replace " << databasePath_ << std::endl;
+    std::remove(tmpPath.str().c_str());
+  }
+}
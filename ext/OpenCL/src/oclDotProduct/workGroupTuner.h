@@ -0,0 +1,34 @@
+#pragma once
+
+#include <map>
+#include <string>
+
+#include <oclUtils.h>
+
+// Local work size autotuner with a persisted per-device database.
+// The database is a text file ($OCL_TUNING_DB, "oclWorkGroupTuning.txt" by default) with one
+// "<device>\t<kernel>\t<local work size>" line per tuned kernel; a local work size of 0 means
+// that passing NULL and letting the driver pick was fastest.
+class WorkGroupTuner
+{
+public:
+  explicit WorkGroupTuner(std::string databasePath = defaultDatabasePath());
+
+  static std::string defaultDatabasePath();
+
+  // Stored winner for the kernel on this device
+  bool lookup(cl_device_id device, const std::string& kernelName, size_t& localWorkSize) const;
+
+  // Times every legal local work size that divides globalWorkSize, plus NULL, with event profiling.
+  // Kernel arguments must already be set. The winner is stored in the database and returned.
+  size_t tune(cl_context context, cl_device_id device, cl_kernel kernel, const std::string& kernelName,
+    size_t globalWorkSize, int repetitions = 3);
+
+  void save() const;
+
+private:
+  static std::string deviceKey(cl_device_id device);
+
+  std::string databasePath_;
+  std::map<std::string, size_t> entries_;  // "<device>\t<kernel>" -> local work size
+};
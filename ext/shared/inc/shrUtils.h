@@ -39,6 +39,7 @@
 #endif
 
 // Other headers needed for both Windows and Linux
+#include <atomic>
 #include <math.h>
 #include <assert.h>
 #include <stdio.h>
@@ -168,15 +169,35 @@ extern "C" int shrLogEx(int iLogMode, int iErrNum, const char* cFormatString, ..
 extern "C" int shrLog(const char* cFormatString, ...);
 
 // *********************************************************************
-// Delta timer function for up to 3 independent timers using host high performance counters 
-// Maintains state for 3 independent counters
+// Delta timer function, kept for the SDK samples on top of shrTimerDelta below
 //! Example: double dElapsedTime = shrDeltaTime(0);
 //! 
-//! @param 0 iCounterID: Which timer to check/reset. (0, 1, 2)
+//! @param 0 iCounterID: Which timer to check/reset (0 to 15, or an id from shrTimerCounter)
 //! @return delta time of specified counter since last call in seconds.  Otherwise -9999.0 if error
 // *********************************************************************
 extern "C" double shrDeltaT(int iCounterID);
 
+// *********************************************************************
+// High resolution timers: any number of counters, each with its own state on every thread, so no locks
+// are taken while timing. The clock is the invariant TSC calibrated against the OS monotonic clock when
+// the CPU has one, otherwise CLOCK_MONOTONIC_RAW (QueryPerformanceCounter on Windows).
+//! Example: const int iUpload = shrTimerCounter("upload");
+//!          shrTimerDelta(iUpload); ... double dSeconds = shrTimerDelta(iUpload);
+// *********************************************************************
+
+//! @return id of the named counter, created on first use (the same for every thread); -1 for NULL
+extern "C" int shrTimerCounter(const char* cName);
+
+//! @return seconds since the previous call for the counter on the calling thread, 0.0 on the first call,
+//!         -9999.0 for an id that is neither reserved (0 to 15) nor returned by shrTimerCounter
+extern "C" double shrTimerDelta(int iCounterID);
+
+//! @return nanoseconds on the timer clock, from an arbitrary origin
+extern "C" unsigned long long shrTimerNanoseconds(void);
+
+//! @return name of the timer clock: "TSC", "CLOCK_MONOTONIC_RAW", "QueryPerformanceCounter" or "steady_clock"
+extern "C" const char* shrTimerSource(void);
+
 // Optional LogFileNameOverride function
 // *********************************************************************
 extern "C" void shrSetLogFileName (const char* cOverRideName);
@@ -561,6 +582,52 @@ extern "C" shrBOOL shrComparefe( const float* reference, const float* data,
 extern "C" shrBOOL shrComparefet( const float* reference, const float* data,
              const unsigned int len, const float epsilon, const float threshold );
 
+////////////////////////////////////////////////////////////////////////////////
+//! Tolerance of shrComparefEx
+////////////////////////////////////////////////////////////////////////////////
+enum shrCompareMode
+{
+    SHR_COMPARE_ABSOLUTE = 0,   // |reference - data| <= epsilon
+    SHR_COMPARE_RELATIVE = 1    // |reference - data| <= epsilon * |reference|
+};
+
+////////////////////////////////////////////////////////////////////////////////
+//! Compare two float arrays on all cores with the widest SIMD the CPU has
+//! (AVX-512, AVX2, else scalar); shrComparef, shrComparefe and shrComparefet run on it too
+//! @return shrTRUEif the mismatches stay within threshold, otherwise shrFALSE
+//! @param reference  handle to the reference data / gold image
+//! @param data       handle to the computed data
+//! @param len        number of elements in reference and data
+//! @param epsilon    tolerance, absolute or relative to the reference element per mode
+//! @param mode       SHR_COMPARE_ABSOLUTE or SHR_COMPARE_RELATIVE
+//! @param threshold  tolerance % # of comparison errors (0.15f = 15%), 0.0f for none
+//! @param earlyExit  shrTRUE to stop as soon as the comparison is known to fail (pass/fail only)
+//! @param errorCount optional, receives the # of mismatches (a lower bound after an early exit)
+////////////////////////////////////////////////////////////////////////////////
+extern "C" shrBOOL shrComparefEx( const float* reference, const float* data, const unsigned int len,
+             const float epsilon, const shrCompareMode mode, const float threshold,
+             const shrBOOL earlyExit, unsigned int* errorCount );
+
+////////////////////////////////////////////////////////////////////////////////
+//! Stop flag shared by the ranges of one comparison, 0 until a range finds a mismatch
+////////////////////////////////////////////////////////////////////////////////
+typedef std::atomic<int> shrCompareStop;
+
+////////////////////////////////////////////////////////////////////////////////
+//! Count the mismatches of one range of two float arrays with SIMD on the calling
+//! thread, for callers that spread a comparison over threads of their own
+//! @return number of mismatches in the range (a lower bound once stop is set)
+//! @param reference  handle to the reference data / gold image
+//! @param data       handle to the computed data
+//! @param len        number of elements in reference and data
+//! @param epsilon    tolerance, absolute or relative to the reference element per mode
+//! @param mode       SHR_COMPARE_ABSOLUTE or SHR_COMPARE_RELATIVE
+//! @param stop       optional, shared by the ranges for a pass/fail check: the range gives up
+//!                   once it is set, and sets it on its first mismatch
+////////////////////////////////////////////////////////////////////////////////
+extern "C" unsigned int shrComparefRange( const float* reference, const float* data, const unsigned int len,
+             const float epsilon, const shrCompareMode mode, shrCompareStop* stop );
+
 ////////////////////////////////////////////////////////////////////////////
 //! Compare two float arrays using L2-norm with an epsilon tolerance for 
 //! equality
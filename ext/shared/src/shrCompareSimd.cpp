@@ -0,0 +1,176 @@
+/*
+ * Copyright 1993-2010 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// *********************************************************************
+// Float comparison kernels: scalar, AVX2 and AVX-512, dispatched at run time.
+// GCC/Clang get the ISA of each kernel through the target pragmas below; MSVC emits
+// the intrinsics without /arch, so the file needs no special build settings.
+// *********************************************************************
+
+#include "shrCompareSimd.h"
+
+#include <math.h>
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define SHR_COMPARE_X86
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+    #endif
+    #include <immintrin.h>
+#endif
+
+// Scalar reference, the same float arithmetic as the original compareData loops
+// *********************************************************************
+size_t shrCountMismatchesScalar(const float* reference, const float* data, size_t n, float tolerance, shrCompareOp op)
+{
+    size_t errors = 0;
+    for (size_t i = 0; i < n; ++i)
+    {
+        const float diff = fabsf(reference[i] - data[i]);
+        bool comp;
+        switch (op)
+        {
+        case SHR_COMPARE_OP_LESS:       comp = diff < tolerance; break;
+        case SHR_COMPARE_OP_LESS_EQUAL: comp = diff <= tolerance; break;
+        default:                        comp = diff <= tolerance * fabsf(reference[i]); break;
+        }
+        errors += !comp;
+    }
+    return errors;
+}
+
+#ifdef SHR_COMPARE_X86
+
+#if defined(__GNUC__)
+#pragma GCC push_options
+#pragma GCC target("avx2")
+#endif
+
+// AVX2, 8 lanes: passing lanes are -1 and subtracted from a per-lane pass count
+// *********************************************************************
+static size_t shrCountMismatchesAvx2(const float* reference, const float* data, size_t n, float tolerance, shrCompareOp op)
+{
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    const __m256 tol = _mm256_set1_ps(tolerance);
+    __m256i passed = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8)
+    {
+        const __m256 ref = _mm256_loadu_ps(reference + i);
+        const __m256 diff = _mm256_and_ps(_mm256_sub_ps(ref, _mm256_loadu_ps(data + i)), absMask);
+        __m256 comp;
+        if (op == SHR_COMPARE_OP_LESS)
+            comp = _mm256_cmp_ps(diff, tol, _CMP_LT_OQ);
+        else if (op == SHR_COMPARE_OP_LESS_EQUAL)
+            comp = _mm256_cmp_ps(diff, tol, _CMP_LE_OQ);
+        else
+            comp = _mm256_cmp_ps(diff, _mm256_mul_ps(tol, _mm256_and_ps(ref, absMask)), _CMP_LE_OQ);
+        passed = _mm256_sub_epi32(passed, _mm256_castps_si256(comp));
+    }
+    __m128i sum = _mm_add_epi32(_mm256_castsi256_si128(passed), _mm256_extracti128_si256(passed, 1));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(1, 0, 3, 2)));
+    sum = _mm_add_epi32(sum, _mm_shuffle_epi32(sum, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (i - (size_t)(unsigned int)_mm_cvtsi128_si32(sum)) + shrCountMismatchesScalar(reference + i, data + i, n - i, tolerance, op);
+}
+
+#if defined(__GNUC__)
+#pragma GCC pop_options
+#pragma GCC push_options
+#pragma GCC target("avx512f")
+#endif
+
+// AVX-512, 16 lanes: the compare mask adds one to the passing lanes
+// *********************************************************************
+static size_t shrCountMismatchesAvx512(const float* reference, const float* data, size_t n, float tolerance, shrCompareOp op)
+{
+    const __m512i absMask = _mm512_set1_epi32(0x7fffffff);
+    const __m512 tol = _mm512_set1_ps(tolerance);
+    const __m512i one = _mm512_set1_epi32(1);
+    __m512i passed = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+    {
+        const __m512 ref = _mm512_loadu_ps(reference + i);
+        const __m512 diff = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(_mm512_sub_ps(ref, _mm512_loadu_ps(data + i))), absMask));
+        __mmask16 comp;
+        if (op == SHR_COMPARE_OP_LESS)
+            comp = _mm512_cmp_ps_mask(diff, tol, _CMP_LT_OQ);
+        else if (op == SHR_COMPARE_OP_LESS_EQUAL)
+            comp = _mm512_cmp_ps_mask(diff, tol, _CMP_LE_OQ);
+        else
+        {
+            const __m512 refAbs = _mm512_castsi512_ps(_mm512_and_si512(_mm512_castps_si512(ref), absMask));
+            comp = _mm512_cmp_ps_mask(diff, _mm512_mul_ps(tol, refAbs), _CMP_LE_OQ);
+        }
+        passed = _mm512_mask_add_epi32(passed, comp, passed, one);
+    }
+    return (i - (size_t)(unsigned int)_mm512_reduce_add_epi32(passed)) + shrCountMismatchesScalar(reference + i, data + i, n - i, tolerance, op);
+}
+
+#if defined(__GNUC__)
+#pragma GCC pop_options
+#endif
+
+// CPUID and XCR0: the OS has to save the YMM/ZMM state as well
+// *********************************************************************
+static shrCountMismatchesFunc shrSelectCountMismatches()
+{
+    unsigned int regs[4] = { 0, 0, 0, 0 }, leaf7[4] = { 0, 0, 0, 0 };
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    const unsigned int maxLeaf = (unsigned int)info[0];
+    __cpuid(info, 1);
+    for (int r = 0; r < 4; ++r) regs[r] = (unsigned int)info[r];
+    if (maxLeaf >= 7)
+    {
+        __cpuidex(info, 7, 0);
+        for (int r = 0; r < 4; ++r) leaf7[r] = (unsigned int)info[r];
+    }
+#else
+    const unsigned int maxLeaf = __get_cpuid_max(0, NULL);
+    __get_cpuid(1, &regs[0], &regs[1], &regs[2], &regs[3]);
+    if (maxLeaf >= 7)
+        __get_cpuid_count(7, 0, &leaf7[0], &leaf7[1], &leaf7[2], &leaf7[3]);
+#endif
+    const bool osxsave = (regs[2] >> 27) & 1;
+    const bool avx = (regs[2] >> 28) & 1;
+    unsigned long long xcr0 = 0;
+    if (osxsave)
+    {
+#ifdef _MSC_VER
+        xcr0 = _xgetbv(0);
+#else
+        unsigned int eax, edx;
+        __asm__ volatile("xgetbv" : "=a"(eax), "=d"(edx) : "c"(0));
+        xcr0 = ((unsigned long long)edx << 32) | eax;
+#endif
+    }
+    if (((leaf7[1] >> 16) & 1) && (xcr0 & 0xe6) == 0xe6)
+        return shrCountMismatchesAvx512;
+    if (avx && ((leaf7[1] >> 5) & 1) && (xcr0 & 0x6) == 0x6)
+        return shrCountMismatchesAvx2;
+    return shrCountMismatchesScalar;
+}
+
+#endif
+
+shrCountMismatchesFunc shrGetCountMismatches()
+{
+#ifdef SHR_COMPARE_X86
+    static const shrCountMismatchesFunc func = shrSelectCountMismatches();
+    return func;
+#else
+    return shrCountMismatchesScalar;
+#endif
+}
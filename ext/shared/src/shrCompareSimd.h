@@ -0,0 +1,37 @@
+/*
+ * Copyright 1993-2010 NVIDIA Corporation.  All rights reserved.
+ *
+ * Please refer to the NVIDIA end user license agreement (EULA) associated
+ * with this source code for terms and conditions that govern your use of
+ * this software. Any use, reproduction, disclosure, or distribution of
+ * this software and related documentation outside the terms of the EULA
+ * is strictly prohibited.
+ *
+ */
+
+// *********************************************************************
+// Float comparison kernels behind the shrCompare* functions (private to shrUtils)
+// *********************************************************************
+
+#ifndef SHR_COMPARE_SIMD_H
+#define SHR_COMPARE_SIMD_H
+
+#include <stddef.h>
+
+// Pass condition of one element, d = |reference - data| computed in float; NaN never passes
+enum shrCompareOp
+{
+    SHR_COMPARE_OP_LESS,        // d <  tolerance  (compareDataAsFloatThreshold)
+    SHR_COMPARE_OP_LESS_EQUAL,  // d <= tolerance  (compareData)
+    SHR_COMPARE_OP_RELATIVE     // d <= tolerance * |reference|
+};
+
+// Number of the n elements that fail, single-threaded
+typedef size_t (*shrCountMismatchesFunc)(const float* reference, const float* data, size_t n, float tolerance, shrCompareOp op);
+
+size_t shrCountMismatchesScalar(const float* reference, const float* data, size_t n, float tolerance, shrCompareOp op);
+
+// Widest kernel the CPU and OS support: AVX-512, AVX2 or scalar, chosen once from CPUID
+shrCountMismatchesFunc shrGetCountMismatches();
+
+#endif
@@ -24,6 +24,26 @@
 #include <vector>
 #include <fstream>
 #include <stdio.h>
+#include <chrono>
+#include <map>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <atomic>
+#include <thread>
+#include <time.h>
+
+#include "shrCompareSimd.h"
+
+#if defined(_M_X64) || defined(_M_IX86) || defined(__x86_64__) || defined(__i386__)
+    #define SHR_TIMER_X86
+    #ifdef _MSC_VER
+        #include <intrin.h>
+    #else
+        #include <cpuid.h>
+        #include <x86intrin.h>
+    #endif
+#endif
 
 using namespace std;
 
@@ -61,95 +81,170 @@ void shrPrintArray(float* pfData, int iSize)
     }
 }
 
-// Helper function to return precision delta time for 3 counters since last call based upon host high performance counter
+// High resolution timers
 // *********************************************************************
-double shrDeltaT(int iCounterID = 0)
+namespace
 {
-    // local var for computation of microseconds since last call
-    double DeltaT;
-
-    #ifdef _WIN32 // Windows version of precision host timer
-
-        // Variables that need to retain state between calls
-        static LARGE_INTEGER liOldCount[3] = { {0, 0}, {0, 0}, {0, 0} };
-
-        // locals for new count, new freq and new time delta 
-	    LARGE_INTEGER liNewCount, liFreq;
-	    if (QueryPerformanceFrequency(&liFreq))
-	    {
-		    // Get new counter reading
-		    QueryPerformanceCounter(&liNewCount);
-
-		    if (iCounterID >= 0 && iCounterID <= 2) 
-		    {
-			    // Calculate time difference for timer 0.  (zero when called the first time) 
-			    DeltaT = liOldCount[iCounterID].LowPart ? (((double)liNewCount.QuadPart - (double)liOldCount[iCounterID].QuadPart) / (double)liFreq.QuadPart) : 0.0;
-			    // Reset old count to new
-			    liOldCount[iCounterID] = liNewCount;
-			}
-			else 
-			{
-		        // Requested counter ID out of range
-		        DeltaT = -9999.0;
-			}
-			
-		    // Returns time difference in seconds sunce the last call
-		    return DeltaT;
-	    }
-	    else
-	    {
-		    // No high resolution performance counter
-		    return -9999.0;
-	    }
-    #elif defined(UNIX) // Linux version of precision host timer. See http://www.informit.com/articles/article.aspx?p=23618&seqNum=8
-        static struct timeval _NewTime;  // new wall clock time (struct representation in seconds and microseconds)
-        static struct timeval _OldTime[3]; // old wall clock timers 0, 1, 2 (struct representation in seconds and microseconds)
-
-        // Get new counter reading
-        gettimeofday(&_NewTime, NULL);
-
-		if (iCounterID >= 0 && iCounterID <= 2) 
-		{
-		    // Calculate time difference for timer (iCounterID).  (zero when called the first time) 
-		    DeltaT =  ((double)_NewTime.tv_sec + 1.0e-6 * (double)_NewTime.tv_usec) - ((double)_OldTime[iCounterID].tv_sec + 1.0e-6 * (double)_OldTime[iCounterID].tv_usec);
-		    // Reset old timer (iCounterID) to new timer
-		    _OldTime[iCounterID].tv_sec  = _NewTime.tv_sec;
-		    _OldTime[iCounterID].tv_usec = _NewTime.tv_usec;
-		}
-		else 
-		{
-	        // Requested counterID is out of rangewith respect to available counters
-	        DeltaT = -9999.0;
-		}
+    // Ids below this are left to shrDeltaT callers and never handed out for names
+    const int SHR_TIMER_RESERVED_IDS = 16;
 
-	    // Returns time difference in seconds sunce the last call
-	    return DeltaT;
+    // Names handed out by shrTimerCounter; ids at or past SHR_TIMER_RESERVED_IDS + this are invalid
+    std::atomic<int> iTimerNames(0);
 
-	#elif defined (__APPLE__) || defined (MACOSX)
-        static time_t _NewTime;
-        static time_t _OldTime[3];
+    // Nanoseconds of the OS monotonic clock the TSC is calibrated against
+    unsigned long long shrClockNanoseconds()
+    {
+    #ifdef _WIN32
+        static const LARGE_INTEGER liFreq = []() { LARGE_INTEGER liFreq; QueryPerformanceFrequency(&liFreq); return liFreq; }();
+        LARGE_INTEGER liCount;
+        QueryPerformanceCounter(&liCount);
+        // Whole seconds and remainder apart, so that the product does not overflow
+        return (unsigned long long)(liCount.QuadPart / liFreq.QuadPart) * 1000000000ull +
+            (unsigned long long)(liCount.QuadPart % liFreq.QuadPart) * 1000000000ull / (unsigned long long)liFreq.QuadPart;
+    #elif defined(CLOCK_MONOTONIC_RAW)
+        // Not slewed by NTP, unlike CLOCK_MONOTONIC and gettimeofday
+        struct timespec tsNow;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &tsNow);
+        return (unsigned long long)tsNow.tv_sec * 1000000000ull + (unsigned long long)tsNow.tv_nsec;
+    #else
+        return (unsigned long long)std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+    #endif
+    }
 
-        _NewTime  = clock();
+    // The TSC is usable as a clock only when it is invariant: constant rate across P-states and not stopped in C-states
+    bool shrInvariantTsc()
+    {
+    #if defined(SHR_TIMER_X86)
+        #ifdef _MSC_VER
+            int iRegs[4];
+            __cpuid(iRegs, 0x80000000);
+            if ((unsigned int)iRegs[0] < 0x80000007)
+                return false;
+            __cpuid(iRegs, 0x80000007);
+            return (iRegs[3] >> 8) & 1;
+        #else
+            unsigned int uiEax, uiEbx, uiEcx, uiEdx;
+            if (__get_cpuid_max(0x80000000, NULL) < 0x80000007 || !__get_cpuid(0x80000007, &uiEax, &uiEbx, &uiEcx, &uiEdx))
+                return false;
+            return (uiEdx >> 8) & 1;
+        #endif
+    #else
+        return false;
+    #endif
+    }
 
-		if (iCounterID >= 0 && iCounterID <= 2) 
-		{
-		    // Calculate time difference for timer (iCounterID).  (zero when called the first time) 
-		    DeltaT = double(_NewTime-_OldTime[iCounterID])/CLOCKS_PER_SEC;
+    struct shrTimerClock
+    {
+        bool bTsc;
+        double dNsPerTick;
+        unsigned long long ullTscBase;
+        unsigned long long ullNsBase;
+        const char* cSource;
+    };
 
-		    // Reset old time (iCounterID) to the new one
-		    _OldTime[iCounterID].tv_sec  = _NewTime.tv_sec;
-		    _OldTime[iCounterID].tv_usec = _NewTime.tv_usec;
-		}
-		else 
-		{
-	        // Requested counter ID out of range
-	        DeltaT = -9999.0;
-		}
-        return DeltaT;
-        #else
-        printf("shrDeltaT returning early\n");
-	#endif
-} 
+    // Ticks per nanosecond from a short spin against the OS clock, taken once on first use
+    shrTimerClock shrCalibrateClock()
+    {
+        shrTimerClock timerClock = { false, 1.0, 0, shrClockNanoseconds(), "" };
+    #if defined(SHR_TIMER_X86)
+        if (shrInvariantTsc())
+        {
+            const unsigned long long CALIBRATION_NS = 10000000ull;
+            const unsigned long long ullNs0 = shrClockNanoseconds();
+            const unsigned long long ullTsc0 = __rdtsc();
+            unsigned long long ullNs1 = ullNs0, ullTsc1 = ullTsc0;
+            while (ullNs1 - ullNs0 < CALIBRATION_NS)
+            {
+                ullNs1 = shrClockNanoseconds();
+                ullTsc1 = __rdtsc();
+            }
+            if (ullTsc1 > ullTsc0)
+            {
+                timerClock.bTsc = true;
+                timerClock.dNsPerTick = (double)(ullNs1 - ullNs0) / (double)(ullTsc1 - ullTsc0);
+                timerClock.ullTscBase = ullTsc1;
+                timerClock.ullNsBase = ullNs1;
+                timerClock.cSource = "TSC";
+                return timerClock;
+            }
+        }
+    #endif
+    #ifdef _WIN32
+        timerClock.cSource = "QueryPerformanceCounter";
+    #elif defined(CLOCK_MONOTONIC_RAW)
+        timerClock.cSource = "CLOCK_MONOTONIC_RAW";
+    #else
+        timerClock.cSource = "steady_clock";
+    #endif
+        return timerClock;
+    }
+
+    const shrTimerClock& shrGetTimerClock()
+    {
+        static const shrTimerClock timerClock = shrCalibrateClock();
+        return timerClock;
+    }
+
+    // Last reading of every counter the calling thread has used, 0 before the first one
+    std::vector<unsigned long long>& shrThreadCounters()
+    {
+        thread_local std::vector<unsigned long long> vCounters;
+        return vCounters;
+    }
+}
+
+unsigned long long shrTimerNanoseconds(void)
+{
+    const shrTimerClock& timerClock = shrGetTimerClock();
+#if defined(SHR_TIMER_X86)
+    if (timerClock.bTsc)
+    {
+        const long long llTicks = (long long)(__rdtsc() - timerClock.ullTscBase);
+        return timerClock.ullNsBase + (unsigned long long)(long long)(timerClock.dNsPerTick * (double)llTicks);
+    }
+#endif
+    return shrClockNanoseconds();
+}
+
+const char* shrTimerSource(void)
+{
+    return shrGetTimerClock().cSource;
+}
+
+int shrTimerCounter(const char* cName)
+{
+    if (cName == NULL)
+        return -1;
+    // Only creating a name takes the lock; callers keep the id for the timing calls
+    static std::mutex mutex;
+    static std::map<std::string, int> mNames;
+    std::lock_guard<std::mutex> lock(mutex);
+    const int iCounterID = mNames.emplace(cName, SHR_TIMER_RESERVED_IDS + (int)mNames.size()).first->second;
+    iTimerNames.store((int)mNames.size(), std::memory_order_release);
+    return iCounterID;
+}
+
+double shrTimerDelta(int iCounterID)
+{
+    if (iCounterID < 0 || iCounterID >= SHR_TIMER_RESERVED_IDS + iTimerNames.load(std::memory_order_acquire))
+        return -9999.0;
+    const unsigned long long ullNow = shrTimerNanoseconds();
+    std::vector<unsigned long long>& vCounters = shrThreadCounters();
+    if ((size_t)iCounterID >= vCounters.size())
+        vCounters.resize(iCounterID + 1, 0);
+    const unsigned long long ullOld = vCounters[iCounterID];
+    vCounters[iCounterID] = ullNow;
+    // Zero when called the first time
+    return ullOld ? 1.0e-9 * (double)(ullNow - ullOld) : 0.0;
+}
+
+// Helper function to return precision delta time since the last call for the counter, on top of shrTimerDelta
+// *********************************************************************
+double shrDeltaT(int iCounterID = 0)
+{
+    return shrTimerDelta(iCounterID);
+}
 
 // Optional LogFileName Override function
 // *********************************************************************
@@ -1621,6 +1716,213 @@ compareDataAsFloatThreshold( const T* reference, const T* data, const unsigned i
     }
 }
 
+//////////////////////////////////////////////////////////////////////////////
+//! Threads of the parallel comparison, started on first use and kept for the
+//! process, so that a comparison never creates threads. One comparison runs on
+//! them at a time; a caller that finds them busy runs its work inline.
+//////////////////////////////////////////////////////////////////////////////
+class shrCompareWorkers
+{
+public:
+    static shrCompareWorkers& instance()
+    {
+        static shrCompareWorkers workers;
+        return workers;
+    }
+
+    size_t size() const { return threads.size() + 1; }
+
+    // Runs work(0) .. work(numThreads - 1), work(0) on the caller; false if another comparison holds the workers
+    bool run( const size_t numThreads, const std::function<void(size_t)>& work )
+    {
+        std::unique_lock<std::mutex> busy( runMutex, std::try_to_lock );
+        if( !busy.owns_lock() )
+            return false;
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            job = &work;
+            jobThreads = numThreads;
+            remaining = numThreads - 1;
+            ++generation;
+        }
+        wake.notify_all();
+        work( 0 );
+        std::unique_lock<std::mutex> lock( mutex );
+        done.wait( lock, [this]() { return remaining == 0; } );
+        job = NULL;
+        return true;
+    }
+
+private:
+    shrCompareWorkers()
+    {
+        const size_t numCores = MAX( (size_t)1, (size_t)std::thread::hardware_concurrency() );
+        for( size_t thread = 1; thread < numCores; ++thread)
+            threads.emplace_back( &shrCompareWorkers::loop, this, thread );
+    }
+
+    ~shrCompareWorkers()
+    {
+        {
+            std::lock_guard<std::mutex> lock( mutex );
+            quit = true;
+        }
+        wake.notify_all();
+        for( auto& thread : threads)
+            thread.join();
+    }
+
+    void loop( const size_t index )
+    {
+        unsigned long long seen = 0;
+        std::unique_lock<std::mutex> lock( mutex );
+        for( ;; ) 
+        {
+            wake.wait( lock, [&]() { return quit || generation != seen; } );
+            if( quit )
+                return;
+            seen = generation;
+            if( index >= jobThreads )
+                continue;
+            const std::function<void(size_t)>* work = job;
+            lock.unlock();
+            (*work)( index );
+            lock.lock();
+            if( --remaining == 0 )
+                done.notify_one();
+        }
+    }
+
+    std::mutex runMutex;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable done;
+    std::vector<std::thread> threads;
+    const std::function<void(size_t)>* job = NULL;
+    size_t jobThreads = 0;
+    size_t remaining = 0;
+    unsigned long long generation = 0;
+    bool quit = false;
+};
+
+// Early exit granularity of the comparison
+static const size_t SHR_COMPARE_BLOCK_SIZE = 1 << 14;
+
+// Mismatches of one range, block by block; with a stop flag, gives up once it is set and sets it on a mismatch
+static size_t
+countMismatchesRange( const float* reference, const float* data, const size_t len,
+                      const float tolerance, const shrCompareOp op, shrCompareStop* stop )
+{
+    const shrCountMismatchesFunc countMismatches = shrGetCountMismatches();
+    size_t errors = 0;
+    for( size_t begin = 0; begin < len; begin += SHR_COMPARE_BLOCK_SIZE) 
+    {
+        if( stop != NULL && stop->load( std::memory_order_relaxed ) )
+            break;
+        errors += countMismatches( reference + begin, data + begin, MIN( SHR_COMPARE_BLOCK_SIZE, len - begin ), tolerance, op );
+        if( stop != NULL && errors > 0 ) 
+        {
+            stop->store( 1, std::memory_order_relaxed );
+            break;
+        }
+    }
+    return errors;
+}
+
+//////////////////////////////////////////////////////////////////////////////
+//! Parallel SIMD comparison of two float arrays: blocks of the range are spread
+//! over up to one persistent worker per core, each counting its mismatches with the
+//! widest kernel of shrCompareSimd.cpp. With earlyExit the workers stop at the first
+//! block after the mismatches have reached the failing count, so errorCount is a lower bound.
+//! @return number of mismatches
+//! @param failAt     mismatch count from which the comparison fails
+//////////////////////////////////////////////////////////////////////////////
+static size_t
+compareFloatParallel( const float* reference, const float* data, const size_t len,
+                      const float tolerance, const shrCompareOp op, const size_t failAt, const bool earlyExit )
+{
+    // The least work worth a thread of its own
+    const size_t MIN_ELEMENTS_PER_THREAD = 1 << 18;
+
+    const shrCountMismatchesFunc countMismatches = shrGetCountMismatches();
+    const size_t numBlocks = (len + SHR_COMPARE_BLOCK_SIZE - 1) / SHR_COMPARE_BLOCK_SIZE;
+    std::atomic<size_t> errors( 0 );
+    std::atomic<bool> stop( earlyExit && failAt == 0 );
+
+    auto work = [&]( const size_t thread, const size_t numThreads )
+    {
+        size_t localErrors = 0;
+        for( size_t block = numBlocks * thread / numThreads; block < numBlocks * (thread + 1) / numThreads; ++block) 
+        {
+            if( stop.load( std::memory_order_relaxed ) )
+                break;
+            const size_t begin = block * SHR_COMPARE_BLOCK_SIZE;
+            const size_t blockErrors = countMismatches( reference + begin, data + begin, MIN( SHR_COMPARE_BLOCK_SIZE, len - begin ), tolerance, op );
+            if( earlyExit && blockErrors > 0 ) 
+            {
+                if( errors.fetch_add( blockErrors ) + blockErrors >= failAt )
+                    stop = true;
+            }
+            else 
+            {
+                localErrors += blockErrors;
+            }
+        }
+        errors += localErrors;
+    };
+
+    if( len < 2 * MIN_ELEMENTS_PER_THREAD ) 
+    {
+        work( 0, 1 );
+        return errors;
+    }
+    shrCompareWorkers& workers = shrCompareWorkers::instance();
+    const size_t numThreads = MIN( workers.size(), len / MIN_ELEMENTS_PER_THREAD );
+    if( !workers.run( numThreads, [&]( size_t thread ) { work( thread, numThreads ); } ) )
+        work( 0, 1 );
+    return errors;
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! Count the mismatches of one range of two float arrays on the calling thread
+//! @return number of mismatches in the range (a lower bound once stop is set)
+////////////////////////////////////////////////////////////////////////////////
+unsigned int shrComparefRange( const float* reference, const float* data, const unsigned int len,
+             const float epsilon, const shrCompareMode mode, shrCompareStop* stop )
+{
+    // No element is within a negative tolerance
+    if( epsilon < 0 )
+        return len;
+
+    const shrCompareOp op = (mode == SHR_COMPARE_RELATIVE) ? SHR_COMPARE_OP_RELATIVE : SHR_COMPARE_OP_LESS_EQUAL;
+    return (unsigned int)countMismatchesRange( reference, data, len, epsilon, op, stop );
+}
+
+// Mismatch count from which len elements fail: any with no threshold, else len*threshold or more
+static size_t
+compareFailAt( const unsigned int len, const float threshold )
+{
+    return (threshold == 0.0f) ? 1 : (size_t)ceil( (double)len * threshold );
+}
+
+////////////////////////////////////////////////////////////////////////////////
+//! Compare two float arrays in parallel with SIMD, absolute or relative tolerance
+//! @return shrTRUE if the mismatches stay within threshold, otherwise shrFALSE
+////////////////////////////////////////////////////////////////////////////////
+shrBOOL shrComparefEx( const float* reference, const float* data, const unsigned int len,
+             const float epsilon, const shrCompareMode mode, const float threshold,
+             const shrBOOL earlyExit, unsigned int* errorCount )
+{
+    ARGCHECK(epsilon >= 0);
+
+    const shrCompareOp op = (mode == SHR_COMPARE_RELATIVE) ? SHR_COMPARE_OP_RELATIVE : SHR_COMPARE_OP_LESS_EQUAL;
+    const size_t failAt = compareFailAt( len, threshold );
+    const size_t errors = compareFloatParallel( reference, data, len, epsilon, op, failAt, earlyExit == shrTRUE );
+    if( errorCount != NULL )
+        *errorCount = (unsigned int)errors;
+    return (errors < failAt) ? shrTRUE : shrFALSE;
+}
+
 ////////////////////////////////////////////////////////////////////////////////
 //! Compare two float arrays
 //! @return shrTRUE if \a reference and \a data are identical, otherwise shrFALSE
@@ -1631,8 +1933,7 @@ compareDataAsFloatThreshold( const T* reference, const T* data, const unsigned i
 shrBOOL shrComparef( const float* reference, const float* data,
             const unsigned int len ) 
 {
-    const float epsilon = 0.0;
-    return compareData( reference, data, len, epsilon, 0.0f );
+    return shrComparefEx( reference, data, len, 0.0f, SHR_COMPARE_ABSOLUTE, 0.0f, shrFALSE, NULL );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1714,7 +2015,7 @@ shrBOOL shrCompareube( const unsigned char* reference, const unsigned char* data
 shrBOOL shrComparefe( const float* reference, const float* data,
              const unsigned int len, const float epsilon ) 
 {
-    return compareData( reference, data, len, epsilon, 0.0f);
+    return shrComparefEx( reference, data, len, epsilon, SHR_COMPARE_ABSOLUTE, 0.0f, shrFALSE, NULL );
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -1729,7 +2030,23 @@ shrBOOL shrComparefe( const float* reference, const float* data,
 shrBOOL shrComparefet( const float* reference, const float* data,
              const unsigned int len, const float epsilon, const float threshold ) 
 {
-    return compareDataAsFloatThreshold( reference, data, len, epsilon, threshold );
+    ARGCHECK(epsilon >= 0);
+
+    // Same pass rule and log as compareDataAsFloatThreshold, on the parallel SIMD path
+    const float max_error = MAX( epsilon, MIN_EPSILON_ERROR );
+    const size_t error_count = compareFloatParallel( reference, data, len, max_error, SHR_COMPARE_OP_LESS,
+                                                     compareFailAt( len, threshold ), false );
+    if (threshold == 0.0f) {
+        if (error_count) {
+            shrLog("\n    Total # of errors = %d\n", (int)error_count);
+        }
+        return (error_count == 0) ? shrTRUE : shrFALSE;
+    } else {
+        if (error_count) {
+            shrLog("\n    %.2f(%%) of bytes mismatched (count=%d)\n", (float)error_count*100/(float)len, (int)error_count);
+        }
+        return ((len*threshold > error_count) ? shrTRUE : shrFALSE);
+    }
 }
 
 ////////////////////////////////////////////////////////////////////////////////
@@ -25,10 +25,13 @@
  // standard utilities and systems includes
 #include <oclUtils.h>
 #include <shrQATest.h>
+#include "workGroupTuner.h"
+#include "dotProductReduction.h"
+#include "perfCounters.h"
 
-// Name of the file with the source code for the computation kernel
+// Source code of the computation kernels, embedded in the binary
 // *********************************************************************
-const char* cSourceFile = "DotProduct.cl";
+#include "dotProduct.cl"
 
 // Host buffers for demo
 // *********************************************************************
@@ -42,6 +45,7 @@ cl_context cxGPUContext;        // OpenCL context
 cl_command_queue cqCommandQueue;// OpenCL command que
 cl_program cpProgram;           // OpenCL program
 cl_kernel ckKernel;             // OpenCL kernel
+cl_kernel ckKernelMulti;        // OpenCL kernel, several elements per work item
 cl_mem cmDevSrcA;               // OpenCL device source buffer A
 cl_mem cmDevSrcB;               // OpenCL device source buffer B 
 cl_mem cmDevDst;                // OpenCL device destination buffer 
@@ -50,8 +54,6 @@ size_t szLocalWorkSize;		    // # of work items in the 1D work group
 size_t szParmDataBytes;			// Byte size of context information
 size_t szKernelLength;			// Byte size of kernel code
 cl_int ciErrNum;			    // Error code var
-char* cPathAndName = NULL;      // var for full paths to data, src, etc.
-char* cSourceCL = NULL;         // Buffer to hold source for compilation 
 const char* cExecutableName = NULL;
 
 // demo config vars
@@ -61,6 +63,7 @@ shrBOOL bNoPrompt = shrFALSE;
 // Forward Declarations
 // *********************************************************************
 void DotProductHost(const float* pfData1, const float* pfData2, float* pfResult, int iNumElements);
+shrBOOL BenchmarkDotProduct();
 void Cleanup(int iExitCode);
 void(*pCleanup)(int) = &Cleanup;
 
@@ -111,6 +114,7 @@ int main(int argc, char **argv)
 
   // get command line arg for quick test, if provided
   bNoPrompt = shrCheckCmdLineFlag(argc, (const char**)argv, "noprompt");
+  PerfCounters::instance().setEnabled(shrCheckCmdLineFlag(argc, (const char**)argv, "perf-counters") == shrTRUE);
 
   // start logs
   cExecutableName = argv[0];
@@ -129,8 +133,11 @@ int main(int argc, char **argv)
   srcB = (void *)malloc(sizeof(cl_float4) * szGlobalWorkSize);
   dst = (void *)malloc(sizeof(cl_float) * szGlobalWorkSize);
   Golden = (void *)malloc(sizeof(cl_float) * iNumElements);
-  shrFillArray((float*)srcA, 4 * iNumElements);
-  shrFillArray((float*)srcB, 4 * iNumElements);
+  {
+    PerfScope perf("shrFillArray");
+    shrFillArray((float*)srcA, 4 * iNumElements);
+    shrFillArray((float*)srcB, 4 * iNumElements);
+  }
 
   // Get the NVIDIA platform
   ciErrNum = oclGetPlatformID(&cpPlatform);
@@ -158,16 +165,10 @@ int main(int argc, char **argv)
   cmDevDst = clCreateBuffer(cxGPUContext, CL_MEM_WRITE_ONLY, sizeof(cl_float) * szGlobalWorkSize, NULL, &ciErrNum);
   oclCheckErrorEX(ciErrNum, CL_SUCCESS, pCleanup);
 
-  // Read the OpenCL kernel in from source file
-  shrLog("oclLoadProgSource (%s)...\n", cSourceFile);
-  cPathAndName = shrFindFilePath(cSourceFile, argv[0]);
-  oclCheckErrorEX(cPathAndName != NULL, shrTRUE, pCleanup);
-  cSourceCL = oclLoadProgSource(cPathAndName, "", &szKernelLength);
-  oclCheckErrorEX(cSourceCL != NULL, shrTRUE, pCleanup);
-
-  // Create the program
+  // Create the program from the embedded source
   shrLog("clCreateProgramWithSource...\n");
-  cpProgram = clCreateProgramWithSource(cxGPUContext, 1, (const char **)&cSourceCL, &szKernelLength, &ciErrNum);
+  szKernelLength = strlen(CL_PROGRAM_DOT_PRODUCT);
+  cpProgram = clCreateProgramWithSource(cxGPUContext, 1, &CL_PROGRAM_DOT_PRODUCT, &szKernelLength, &ciErrNum);
 
   // Build the program with 'mad' Optimization option
 #ifdef MAC
@@ -189,13 +190,22 @@ int main(int argc, char **argv)
   // Create the kernel
   shrLog("clCreateKernel (DotProduct)...\n");
   ckKernel = clCreateKernel(cpProgram, "DotProduct", &ciErrNum);
+  oclCheckErrorEX(ciErrNum, CL_SUCCESS, pCleanup);
+  shrLog("clCreateKernel (DotProductMulti)...\n");
+  ckKernelMulti = clCreateKernel(cpProgram, "DotProductMulti", &ciErrNum);
+  oclCheckErrorEX(ciErrNum, CL_SUCCESS, pCleanup);
 
-  // Set the Argument values
+  // Set the Argument values, the same for both kernels
   shrLog("clSetKernelArg 0 - 3...\n\n");
-  ciErrNum = clSetKernelArg(ckKernel, 0, sizeof(cl_mem), (void*)&cmDevSrcA);
-  ciErrNum |= clSetKernelArg(ckKernel, 1, sizeof(cl_mem), (void*)&cmDevSrcB);
-  ciErrNum |= clSetKernelArg(ckKernel, 2, sizeof(cl_mem), (void*)&cmDevDst);
-  ciErrNum |= clSetKernelArg(ckKernel, 3, sizeof(cl_int), (void*)&iNumElements);
+  ciErrNum = CL_SUCCESS;
+  cl_kernel kernels[] = { ckKernel, ckKernelMulti };
+  for (cl_kernel kernel : kernels)
+  {
+    ciErrNum |= clSetKernelArg(kernel, 0, sizeof(cl_mem), (void*)&cmDevSrcA);
+    ciErrNum |= clSetKernelArg(kernel, 1, sizeof(cl_mem), (void*)&cmDevSrcB);
+    ciErrNum |= clSetKernelArg(kernel, 2, sizeof(cl_mem), (void*)&cmDevDst);
+    ciErrNum |= clSetKernelArg(kernel, 3, sizeof(cl_int), (void*)&iNumElements);
+  }
   oclCheckErrorEX(ciErrNum, CL_SUCCESS, pCleanup);
 
   // --------------------------------------------------------
@@ -207,9 +217,28 @@ int main(int argc, char **argv)
   ciErrNum |= clEnqueueWriteBuffer(cqCommandQueue, cmDevSrcB, CL_FALSE, 0, sizeof(cl_float) * szGlobalWorkSize * 4, srcB, 0, NULL, NULL);
   oclCheckErrorEX(ciErrNum, CL_SUCCESS, pCleanup);
 
+  // Pick the local work size: tuned now with --autotune, else the stored winner for this device.
+  // Every candidate divides szGlobalWorkSize, so the buffers sized above stay valid.
+  {
+    WorkGroupTuner tuner;
+    size_t szTuned = szLocalWorkSize;
+    if (shrCheckCmdLineFlag(argc, (const char**)argv, "autotune"))
+    {
+      clFinish(cqCommandQueue);
+      szTuned = tuner.tune(cxGPUContext, cdDevices[uiTargetDevice], ckKernel, "DotProduct", szGlobalWorkSize);
+      tuner.save();
+    }
+    else if (!tuner.lookup(cdDevices[uiTargetDevice], "DotProduct", szTuned) || (szTuned != 0 && szGlobalWorkSize % szTuned != 0))
+    {
+      szTuned = szLocalWorkSize;
+    }
+    szLocalWorkSize = szTuned;
+    shrLog("Local Work Size (tuned) \t= %u\n\n", szLocalWorkSize);
+  }
+
   // Launch kernel
   shrLog("clEnqueueNDRangeKernel (DotProduct)...\n");
-  ciErrNum = clEnqueueNDRangeKernel(cqCommandQueue, ckKernel, 1, NULL, &szGlobalWorkSize, &szLocalWorkSize, 0, NULL, NULL);
+  ciErrNum = clEnqueueNDRangeKernel(cqCommandQueue, ckKernel, 1, NULL, &szGlobalWorkSize, szLocalWorkSize ? &szLocalWorkSize : NULL, 0, NULL, NULL);
   oclCheckErrorEX(ciErrNum, CL_SUCCESS, pCleanup);
 
   // Read back results and check accumulated errors
@@ -220,10 +249,47 @@ int main(int argc, char **argv)
   // Compute and compare results for golden-host and report errors and pass/fail
   shrLog("Comparing against Host/C++ computation...\n\n");
   DotProductHost((const float*)srcA, (const float*)srcB, (float*)Golden, iNumElements);
-  shrBOOL bMatch = shrComparefet((const float*)Golden, (const float*)dst, (unsigned int)iNumElements, 0.0f, 0);
+  shrBOOL bMatch;
+  {
+    PerfScope perf("compareDataAsFloatThreshold");
+    bMatch = shrComparefet((const float*)Golden, (const float*)dst, (unsigned int)iNumElements, 0.0f, 0);
+  }
 
-  // Cleanup and leave
-  Cleanup(EXIT_SUCCESS);
+  // Scalar dot product reduced on the device: only the per-group partial sums and the scalar are read back
+  {
+    DotProductReducer reducer(cxGPUContext, cdDevices[uiTargetDevice]);
+    oclCheckErrorEX(reducer.valid(), true, pCleanup);
+    std::vector<float> partialSums;
+    shrLog("Reducing on the device...\n");
+    float fDeviceSum = 0.0f;
+    ciErrNum = reducer.reduce(cqCommandQueue, cmDevSrcA, cmDevSrcB, iNumElements, fDeviceSum, &partialSums);
+    oclCheckErrorEX(ciErrNum, CL_SUCCESS, pCleanup);
+    const double dHostSum = dotProductHost((const float*)srcA, (const float*)srcB, 4 * (size_t)iNumElements);
+    const double dRelError = fabs(fDeviceSum - dHostSum) / (fabs(dHostSum) > 0.0 ? fabs(dHostSum) : 1.0);
+    shrLog("  Device sum = %.6e (%u partial sums), host sum = %.6e, relative error = %.3e\n\n",
+      fDeviceSum, (unsigned int)partialSums.size(), dHostSum, dRelError);
+    // A wrong device sum fails the sample like a wrong DotProduct result
+    const shrBOOL bSumMatch = (shrBOOL)(dRelError < 1.0e-4);
+    if (!bSumMatch)
+    {
+      shrLog("  Device sum MISMATCH, relative error above 1.0e-4\n\n");
+    }
+    bMatch = (shrBOOL)(bMatch && bSumMatch);
+
+    if (shrCheckCmdLineFlag(argc, (const char**)argv, "benchmark-reduction"))
+    {
+      benchmarkDotProductReduction(cxGPUContext, cdDevices[uiTargetDevice], cqCommandQueue);
+    }
+  }
+
+  // Kernel throughput against the host, --benchmark-dot-product
+  if (shrCheckCmdLineFlag(argc, (const char**)argv, "benchmark-dot-product"))
+  {
+    bMatch = (shrBOOL)(BenchmarkDotProduct() && bMatch);
+  }
+
+  // Cleanup and leave, failing the sample when any check above failed
+  Cleanup(bMatch ? EXIT_SUCCESS : EXIT_FAILURE);
 }
 
 // "Golden" Host processing dot product function for comparison purposes
@@ -241,15 +307,80 @@ void DotProductHost(const float* pfData1, const float* pfData2, float* pfResult,
   }
 }
 
+// Device time and throughput of both kernels against DotProductHost, best of several runs.
+// Inputs stay on the device; every element reads two float4 and writes one float.
+// Every DotProductMulti launch shape is also checked against Golden; returns whether all of them match.
+// *********************************************************************
+shrBOOL BenchmarkDotProduct()
+{
+  const int iRepetitions = 10;
+  const double dBytes = (2.0 * sizeof(cl_float4) + sizeof(cl_float)) * iNumElements;
+  const size_t* pszLocal = szLocalWorkSize ? &szLocalWorkSize : NULL;
+  const int iRoundTo = szLocalWorkSize ? (int)szLocalWorkSize : 256;
+
+  shrLog("\nDotProduct throughput, %d elements, best of %d runs\n", iNumElements, iRepetitions);
+  shrLog("  %-28s %10s %10s %12s\n", "variant", "ms", "GB/s", "Melements/s");
+  auto report = [&](const char* cName, double dSeconds)
+  {
+    shrLog("  %-28s %10.3f %10.2f %12.1f\n", cName, 1.0e3 * dSeconds, 1.0e-9 * dBytes / dSeconds, 1.0e-6 * iNumElements / dSeconds);
+  };
+  auto timeKernel = [&](cl_kernel kernel, size_t szGlobal)
+  {
+    double dBest = 0.0;
+    clEnqueueNDRangeKernel(cqCommandQueue, kernel, 1, NULL, &szGlobal, pszLocal, 0, NULL, NULL);
+    clFinish(cqCommandQueue);
+    for (int i = 0; i < iRepetitions; i++)
+    {
+      shrDeltaT(1);
+      clEnqueueNDRangeKernel(cqCommandQueue, kernel, 1, NULL, &szGlobal, pszLocal, 0, NULL, NULL);
+      clFinish(cqCommandQueue);
+      const double dSeconds = shrDeltaT(1);
+      dBest = (i == 0 || dSeconds < dBest) ? dSeconds : dBest;
+    }
+    return dBest;
+  };
+
+  report("DotProduct (float4 dot)", timeKernel(ckKernel, szGlobalWorkSize));
+  shrBOOL bMatch = shrTRUE;
+  std::vector<cl_float> zeros(szGlobalWorkSize, 0.0f);
+  for (int iPerItem = 2; iPerItem <= 16; iPerItem *= 2)
+  {
+    char cName[64];
+    sprintf(cName, "DotProductMulti (%d per item)", iPerItem);
+    size_t szGlobal = shrRoundUp(iRoundTo, (iNumElements + iPerItem - 1) / iPerItem);
+    report(cName, timeKernel(ckKernelMulti, szGlobal));
+
+    // One more run on a cleared destination, so the DotProduct results still in cmDevDst cannot pass for it
+    ciErrNum = clEnqueueWriteBuffer(cqCommandQueue, cmDevDst, CL_FALSE, 0, sizeof(cl_float) * szGlobalWorkSize, zeros.data(), 0, NULL, NULL);
+    ciErrNum |= clEnqueueNDRangeKernel(cqCommandQueue, ckKernelMulti, 1, NULL, &szGlobal, pszLocal, 0, NULL, NULL);
+    ciErrNum |= clEnqueueReadBuffer(cqCommandQueue, cmDevDst, CL_TRUE, 0, sizeof(cl_float) * szGlobalWorkSize, dst, 0, NULL, NULL);
+    const shrBOOL bPerItemMatch = (shrBOOL)(ciErrNum == CL_SUCCESS &&
+      shrComparefet((const float*)Golden, (const float*)dst, (unsigned int)iNumElements, 0.0f, 0));
+    shrLog("  %-28s %s\n", "", bPerItemMatch ? "matches DotProductHost" : "MISMATCH against DotProductHost");
+    bMatch = (shrBOOL)(bMatch && bPerItemMatch);
+  }
+
+  double dBest = 0.0;
+  for (int i = 0; i < iRepetitions; i++)
+  {
+    shrDeltaT(1);
+    DotProductHost((const float*)srcA, (const float*)srcB, (float*)Golden, iNumElements);
+    const double dSeconds = shrDeltaT(1);
+    dBest = (i == 0 || dSeconds < dBest) ? dSeconds : dBest;
+  }
+  report("DotProductHost", dBest);
+  shrLog("\n");
+  return bMatch;
+}
+
 // Cleanup and exit code
 // *********************************************************************
 void Cleanup(int iExitCode)
 {
   // Cleanup allocated objects
   shrLog("Starting Cleanup...\n\n");
-  if (cPathAndName)free(cPathAndName);
-  if (cSourceCL)free(cSourceCL);
   if (ckKernel)clReleaseKernel(ckKernel);
+  if (ckKernelMulti)clReleaseKernel(ckKernelMulti);
   if (cpProgram)clReleaseProgram(cpProgram);
   if (cqCommandQueue)clReleaseCommandQueue(cqCommandQueue);
   if (cxGPUContext)clReleaseContext(cxGPUContext);